@@ -1,32 +1,124 @@
 #include "GammaManager.h"
 #include "GammaManagerConfig.h"
 
-// Applies gamma correction from matrices defined in the main project
+// Applies gamma correction from the profile's matrices
 void GammaManager::Correct(CRGB& pixel) {
-  pixel.r = pgm_read_byte(&gammaR[pixel.r]);
-  pixel.g = pgm_read_byte(&gammaG[pixel.g]);
-  pixel.b = pgm_read_byte(&gammaB[pixel.b]);
+  pixel.r = pgm_read_byte(&profile->gammaR[pixel.r]);
+  pixel.g = pgm_read_byte(&profile->gammaG[pixel.g]);
+  pixel.b = pgm_read_byte(&profile->gammaB[pixel.b]);
 }
 
 // Inverse function of Correct(); Use on already corrected colors prior to interpolating and re-correcting
 void GammaManager::Inverse(CRGB& pixel) {
-  pixel.r = pgm_read_byte(&reverseGammaR[pixel.r]);
-  pixel.g = pgm_read_byte(&reverseGammaG[pixel.g]);
-  pixel.b = pgm_read_byte(&reverseGammaB[pixel.b]);
+  pixel.r = pgm_read_byte(&profile->reverseGammaR[pixel.r]);
+  pixel.g = pgm_read_byte(&profile->reverseGammaG[pixel.g]);
+  pixel.b = pgm_read_byte(&profile->reverseGammaB[pixel.b]);
+}
+
+// Correct() over a block of pixels, unrolled 4 pixels at a time
+void GammaManager::CorrectRange(CRGB* pixels, uint16_t count) {
+  const uint8_t* gammaR = profile->gammaR;
+  const uint8_t* gammaG = profile->gammaG;
+  const uint8_t* gammaB = profile->gammaB;
+  uint16_t i = 0;
+  for(; i + 4 <= count; i += 4) {
+    pixels[i].r   = pgm_read_byte(&gammaR[pixels[i].r]);
+    pixels[i].g   = pgm_read_byte(&gammaG[pixels[i].g]);
+    pixels[i].b   = pgm_read_byte(&gammaB[pixels[i].b]);
+    pixels[i+1].r = pgm_read_byte(&gammaR[pixels[i+1].r]);
+    pixels[i+1].g = pgm_read_byte(&gammaG[pixels[i+1].g]);
+    pixels[i+1].b = pgm_read_byte(&gammaB[pixels[i+1].b]);
+    pixels[i+2].r = pgm_read_byte(&gammaR[pixels[i+2].r]);
+    pixels[i+2].g = pgm_read_byte(&gammaG[pixels[i+2].g]);
+    pixels[i+2].b = pgm_read_byte(&gammaB[pixels[i+2].b]);
+    pixels[i+3].r = pgm_read_byte(&gammaR[pixels[i+3].r]);
+    pixels[i+3].g = pgm_read_byte(&gammaG[pixels[i+3].g]);
+    pixels[i+3].b = pgm_read_byte(&gammaB[pixels[i+3].b]);
+  }
+  for(; i < count; i++) { Correct(pixels[i]); }
+}
+
+// Inverse() over a block of pixels, unrolled 4 pixels at a time
+void GammaManager::InverseRange(CRGB* pixels, uint16_t count) {
+  const uint8_t* reverseGammaR = profile->reverseGammaR;
+  const uint8_t* reverseGammaG = profile->reverseGammaG;
+  const uint8_t* reverseGammaB = profile->reverseGammaB;
+  uint16_t i = 0;
+  for(; i + 4 <= count; i += 4) {
+    pixels[i].r   = pgm_read_byte(&reverseGammaR[pixels[i].r]);
+    pixels[i].g   = pgm_read_byte(&reverseGammaG[pixels[i].g]);
+    pixels[i].b   = pgm_read_byte(&reverseGammaB[pixels[i].b]);
+    pixels[i+1].r = pgm_read_byte(&reverseGammaR[pixels[i+1].r]);
+    pixels[i+1].g = pgm_read_byte(&reverseGammaG[pixels[i+1].g]);
+    pixels[i+1].b = pgm_read_byte(&reverseGammaB[pixels[i+1].b]);
+    pixels[i+2].r = pgm_read_byte(&reverseGammaR[pixels[i+2].r]);
+    pixels[i+2].g = pgm_read_byte(&reverseGammaG[pixels[i+2].g]);
+    pixels[i+2].b = pgm_read_byte(&reverseGammaB[pixels[i+2].b]);
+    pixels[i+3].r = pgm_read_byte(&reverseGammaR[pixels[i+3].r]);
+    pixels[i+3].g = pgm_read_byte(&reverseGammaG[pixels[i+3].g]);
+    pixels[i+3].b = pgm_read_byte(&reverseGammaB[pixels[i+3].b]);
+  }
+  for(; i < count; i++) { Inverse(pixels[i]); }
 }
 
 // Initialize the Gamma controller with a pointer to the global brightness variable
-void GammaManager::Init(CRGB* _leds, uint8_t* _leds_b, uint8_t* _leds_5bit_brightness, uint16_t _numLEDs, uint8_t *_globalBrightness) {
+void GammaManager::Init(CRGB* _leds, uint8_t* _leds_b, uint8_t* _leds_5bit_brightness, uint16_t _numLEDs, uint8_t *_globalBrightness, const GammaProfile* _profile) {
     leds = _leds;
     leds_b = _leds_b;
     leds_5bit_brightness = _leds_5bit_brightness;
     numLEDs = _numLEDs;
     globalBrightness = _globalBrightness;
+    profile = _profile;
+    interleavedTables = NULL;
+    #ifdef ENABLE_GAMMA_STATS
+      ResetStats();
+    #endif
+    for(uint8_t i = 0; i < 32; i++) { colorCorrections[i] = defaultColorCorrections[i]; }
+    prepCacheValid = false;
     #ifdef ENABLE_COLOR_CORRECTION_TESTS
       SetAllColorCorrections(0xFFFFFF);
+      RebuildTuningMatrices();
     #endif
 }
 
+// Switches to another set of matrices, e.g. one shared with other strips from the same LED batch
+void GammaManager::SetProfile(const GammaProfile* _profile) {
+  profile = _profile;
+  interleavedTables = NULL;
+  prepCacheValid = false;
+}
+
+// Prep reads gamma and dimming from tables in the interleaved layout, which must match the current profile. Use
+// defaultInterleavedTables (in flash, C++14) or a copy made with BuildInterleavedTables(), e.g. DRAM_ATTR on ESP32.
+// SetProfile() reverts to the profile's own matrices. NULL disables
+void GammaManager::SetInterleavedTables(const GammaInterleavedTables* tables) {
+  interleavedTables = tables;
+  prepCacheValid = false;
+}
+
+void BuildInterleavedTables(GammaInterleavedTables* tables, const GammaProfile* profile) {
+  for(uint16_t i = 0; i <= 255; i++) {
+    tables->rgb[i][0] = pgm_read_byte(&profile->gammaR[i]);
+    tables->rgb[i][1] = pgm_read_byte(&profile->gammaG[i]);
+    tables->rgb[i][2] = pgm_read_byte(&profile->gammaB[i]);
+    tables->rgb[i][3] = 0;
+    tables->dim[i][0] = pgm_read_byte(&profile->gammaDim_5bit[i]);
+    tables->dim[i][1] = pgm_read_byte(&profile->gammaDim[i]);
+  }
+}
+
+void GammaManager::SetAllColorCorrections(uint32_t colCorrect) {
+  CRGB temp = CRGB(colCorrect);
+  for(uint8_t i = 0; i < 32; i++) { colorCorrections[i] = temp; }
+  prepCacheValid = false;
+}
+
+// Sets the color correction used for pixels whose 5-bit brightness is brightness5bit
+void GammaManager::SetColorCorrection(uint8_t brightness5bit, CRGB correction) {
+  colorCorrections[brightness5bit & 31] = correction;
+  prepCacheValid = false;
+}
+
 // Blend two previously-corrected CRGBs using Gamma correction
 CRGB GammaManager::Blend(CRGB& a, CRGB& b, fract8 blendAmount) {
 	CRGB tempA = a;
@@ -47,236 +139,1449 @@ void GammaManager::BlendInPlace(CRGB& a, CRGB& b, fract8 blendAmount) {
 	Correct(a);
 }
 
-void GammaManager::PrepPixelsForFastLED() { // Todo: Optimize performance of this function 
-  if(*globalBrightness == 0) {
-    for(uint16_t i = 0; i < numLEDs; i++) { leds_5bit_brightness[i] = 0; }
+// The six matrices the blend kernels read, copied out of the profile once per call. As locals they stay in registers; read
+// through profile they would be reloaded for every channel, since the uint8_t stores to pixels may alias anything
+struct BlendTables {
+  const uint8_t* gammaR;
+  const uint8_t* gammaG;
+  const uint8_t* gammaB;
+  const uint8_t* reverseGammaR;
+  const uint8_t* reverseGammaG;
+  const uint8_t* reverseGammaB;
+
+  BlendTables(const GammaProfile* profile) : gammaR(profile->gammaR), gammaG(profile->gammaG), gammaB(profile->gammaB),
+    reverseGammaR(profile->reverseGammaR), reverseGammaG(profile->reverseGammaG), reverseGammaB(profile->reverseGammaB) {}
+
+  inline CRGB Inverse(const CRGB& pixel) const {
+    return CRGB(pgm_read_byte(&reverseGammaR[pixel.r]), pgm_read_byte(&reverseGammaG[pixel.g]), pgm_read_byte(&reverseGammaB[pixel.b]));
+  }
+
+  // BlendInPlace() on one pixel whose target color has already been passed through Inverse()
+  inline void BlendTowardInverse(CRGB& a, const CRGB& bInverse, fract8 blendAmount) const {
+    a.r = pgm_read_byte(&gammaR[blend8(pgm_read_byte(&reverseGammaR[a.r]), bInverse.r, blendAmount)]);
+    a.g = pgm_read_byte(&gammaG[blend8(pgm_read_byte(&reverseGammaG[a.g]), bInverse.g, blendAmount)]);
+    a.b = pgm_read_byte(&gammaB[blend8(pgm_read_byte(&reverseGammaB[a.b]), bInverse.b, blendAmount)]);
+  }
+};
+
+// Destructively blend a buffer of previously-corrected CRGBs toward another buffer
+void GammaManager::BlendRange(CRGB* a, const CRGB* b, uint16_t count, fract8 blendAmount) {
+  const BlendTables tables(profile);
+  for(uint16_t i = 0; i < count; i++) { tables.BlendTowardInverse(a[i], tables.Inverse(b[i]), blendAmount); }
+}
+
+// As above, with a separate blend amount per pixel
+void GammaManager::BlendRange(CRGB* a, const CRGB* b, uint16_t count, const fract8* blendAmounts) {
+  const BlendTables tables(profile);
+  for(uint16_t i = 0; i < count; i++) { tables.BlendTowardInverse(a[i], tables.Inverse(b[i]), blendAmounts[i]); }
+}
+
+// Destructively blend a buffer of previously-corrected CRGBs toward a single color
+void GammaManager::BlendRange(CRGB* a, const CRGB& b, uint16_t count, fract8 blendAmount) {
+  const BlendTables tables(profile);
+  const CRGB bInverse = tables.Inverse(b);
+  for(uint16_t i = 0; i < count; i++) { tables.BlendTowardInverse(a[i], bInverse, blendAmount); }
+}
+
+// As above, with a separate blend amount per pixel
+void GammaManager::BlendRange(CRGB* a, const CRGB& b, uint16_t count, const fract8* blendAmounts) {
+  const BlendTables tables(profile);
+  const CRGB bInverse = tables.Inverse(b);
+  for(uint16_t i = 0; i < count; i++) { tables.BlendTowardInverse(a[i], bInverse, blendAmounts[i]); }
+}
+
+// Per-pixel 16.16 increment from start to end, rounded so long gradients don't drift toward either end
+static inline int32_t GradientStep(int32_t start, int32_t end, uint16_t steps) {
+  int32_t delta = (end - start) * 65536;
+  return (delta + (delta < 0 ? -(steps/2) : steps/2)) / steps;
+}
+
+// Fills count pixels with a gradient from start to end (both inclusive), interpolated linearly and written already passed through Inverse().
+// Does the work of fill_gradient_RGB() followed by InverseRange() in one pass, but interpolates in 16.16 fixed point rounded to nearest.
+// FastLED truncates its 8.7 step, so its channels drift from these by a few levels on long gradients. Lookups are skipped while a channel holds its value
+void GammaManager::FillGradientRGB(CRGB* pixels, uint16_t count, const CRGB& start, const CRGB& end) {
+  if(count == 0) { return; }
+  const uint8_t* reverseGammaR = profile->reverseGammaR;
+  const uint8_t* reverseGammaG = profile->reverseGammaG;
+  const uint8_t* reverseGammaB = profile->reverseGammaB;
+
+  uint16_t steps = count > 1 ? count - 1 : 1;
+  int32_t stepR = GradientStep(start.r, end.r, steps);
+  int32_t stepG = GradientStep(start.g, end.g, steps);
+  int32_t stepB = GradientStep(start.b, end.b, steps);
+  int32_t accR = (int32_t(start.r) << 16) + 0x8000;
+  int32_t accG = (int32_t(start.g) << 16) + 0x8000;
+  int32_t accB = (int32_t(start.b) << 16) + 0x8000;
+
+  uint8_t lastR = start.r, lastG = start.g, lastB = start.b;
+  CRGB out(pgm_read_byte(&reverseGammaR[lastR]), pgm_read_byte(&reverseGammaG[lastG]), pgm_read_byte(&reverseGammaB[lastB]));
+  for(uint16_t i = 0; i < count; i++) {
+    uint8_t r = i == steps ? end.r : accR >> 16;
+    uint8_t g = i == steps ? end.g : accG >> 16;
+    uint8_t b = i == steps ? end.b : accB >> 16;
+    if(r != lastR) { lastR = r; out.r = pgm_read_byte(&reverseGammaR[r]); }
+    if(g != lastG) { lastG = g; out.g = pgm_read_byte(&reverseGammaG[g]); }
+    if(b != lastB) { lastB = b; out.b = pgm_read_byte(&reverseGammaB[b]); }
+    pixels[i] = out;
+    accR += stepR;
+    accG += stepG;
+    accB += stepB;
+  }
+}
+
+// As above, through HSV with FastLED's hue directions; like fill_gradient() followed by InverseRange(), with the same rounding difference
+void GammaManager::FillGradientHSV(CRGB* pixels, uint16_t count, const CHSV& start, const CHSV& end, TGradientDirectionCode directionCode) {
+  if(count == 0) { return; }
+  const uint8_t* reverseGammaR = profile->reverseGammaR;
+  const uint8_t* reverseGammaG = profile->reverseGammaG;
+  const uint8_t* reverseGammaB = profile->reverseGammaB;
+
+  // Signed hue distance in the requested direction
+  uint8_t forward = end.hue - start.hue;
+  bool goForward = directionCode == FORWARD_HUES ||
+    (directionCode == SHORTEST_HUES && forward <= 127) ||
+    (directionCode == LONGEST_HUES && forward > 127);
+  int32_t hueDistance = goForward ? forward : -int32_t(uint8_t(start.hue - end.hue));
+  if(directionCode == LONGEST_HUES && forward == 0) { hueDistance = 256; }
+
+  uint16_t steps = count > 1 ? count - 1 : 1;
+  uint32_t stepH = uint32_t(hueDistance * 65536 / steps);
+  int32_t stepS = GradientStep(start.sat, end.sat, steps);
+  int32_t stepV = GradientStep(start.val, end.val, steps);
+  uint32_t accH = (uint32_t(start.hue) << 16) + 0x8000;
+  int32_t accS = (int32_t(start.sat) << 16) + 0x8000;
+  int32_t accV = (int32_t(start.val) << 16) + 0x8000;
+
+  CHSV last(start.hue+1, start.sat, start.val);
+  CRGB out;
+  for(uint16_t i = 0; i < count; i++) {
+    CHSV hsv = i == steps ? end : CHSV(accH >> 16, accS >> 16, accV >> 16);
+    if(hsv.hue != last.hue || hsv.sat != last.sat || hsv.val != last.val) {
+      last = hsv;
+      hsv2rgb_rainbow(hsv, out);
+      out.r = pgm_read_byte(&reverseGammaR[out.r]);
+      out.g = pgm_read_byte(&reverseGammaG[out.g]);
+      out.b = pgm_read_byte(&reverseGammaB[out.b]);
+    }
+    pixels[i] = out;
+    accH += stepH;
+    accS += stepS;
+    accV += stepV;
+  }
+}
+
+// Multi-stop gradients; stops are spread evenly over count pixels and adjacent segments share their stop pixel.
+// With fewer pixels than stops, segments that collapse onto a pixel already written are skipped, so one pixel takes the first stop
+void GammaManager::FillGradientRGB(CRGB* pixels, uint16_t count, const CRGB* stops, uint8_t numStops) {
+  if(count == 0) { return; }
+  if(numStops < 2) {
+    if(numStops == 1) { FillGradientRGB(pixels, count, stops[0], stops[0]); }
     return;
   }
+  for(uint8_t s = 0; s < numStops - 1; s++) {
+    uint16_t first = uint32_t(count - 1) * s / (numStops - 1);
+    uint16_t last = uint32_t(count - 1) * (s + 1) / (numStops - 1);
+    if(first == last && s > 0) { continue; }
+    FillGradientRGB(&pixels[first], last - first + 1, stops[s], stops[s+1]);
+  }
+}
 
+void GammaManager::FillGradientHSV(CRGB* pixels, uint16_t count, const CHSV* stops, uint8_t numStops, TGradientDirectionCode directionCode) {
+  if(count == 0) { return; }
+  if(numStops < 2) {
+    if(numStops == 1) { FillGradientHSV(pixels, count, stops[0], stops[0], FORWARD_HUES); }
+    return;
+  }
+  for(uint8_t s = 0; s < numStops - 1; s++) {
+    uint16_t first = uint32_t(count - 1) * s / (numStops - 1);
+    uint16_t last = uint32_t(count - 1) * (s + 1) / (numStops - 1);
+    if(first == last && s > 0) { continue; }
+    FillGradientHSV(&pixels[first], last - first + 1, stops[s], stops[s+1], directionCode);
+  }
+}
+
+// The 5-bit brightness and dim amount for a dimming level, from the interleaved tables when set
+inline void GammaManager::ReadDim(uint8_t level, uint8_t& brightness5bit, uint8_t& dimAmount) {
+  if(interleavedTables != NULL) {
+    brightness5bit = pgm_read_byte(&interleavedTables->dim[level][0]);
+    dimAmount = pgm_read_byte(&interleavedTables->dim[level][1]);
+  }
+  else {
+    brightness5bit = pgm_read_byte(&profile->gammaDim_5bit[level]);
+    dimAmount = pgm_read_byte(&profile->gammaDim[level]);
+  }
+}
+
+// Relative light output of a leds_b level: its 5-bit brightness times its dimming, as Prep applies them at full globalBrightness
+inline uint16_t GammaManager::DimLight(uint8_t level) {
+  uint8_t brightness5bit, dimAmount;
+  ReadDim(level, brightness5bit, dimAmount);
+  return brightness5bit * (dimAmount + 1);
+}
+
+// The leds_b level whose DimLight() is closest to light; a binary search, since the gammaDim curve only increases
+uint8_t GammaManager::DimLevelForLight(uint16_t light) {
+  uint8_t lo = 0;
+  uint8_t hi = 255;
+  while(lo < hi) {
+    uint8_t mid = lo + (hi - lo) / 2;
+    if(DimLight(mid) < light) { lo = mid + 1; }
+    else { hi = mid; }
+  }
+  if(lo > 0 && light - DimLight(lo - 1) < DimLight(lo) - light) { lo--; }
+  return lo;
+}
+
+// Crossfades two complete frames of previously-corrected colors into outLeds/out_b, in one pass; each defaults to leds[]/leds_b[] on its own.
+// Brightness is interpolated in light along the gammaDim curve, and colors mix in proportion to the light each frame contributes,
+// so a pixel fading in from black keeps its color. Runs of identical pixels reuse the previous result
+void GammaManager::CrossfadeFrames(const CRGB* fromLeds, const uint8_t* from_b, const CRGB* toLeds, const uint8_t* to_b, fract8 amount, CRGB* outLeds, uint8_t* out_b) {
+  if(outLeds == NULL) { outLeds = leds; }
+  if(out_b == NULL) { out_b = leds_b; }
+  if(outLeds == leds || out_b == leds_b) { MarkAllDirty(); }
+  if(amount == 0) {
+    if(outLeds != fromLeds) { memcpy(outLeds, fromLeds, numLEDs * sizeof(CRGB)); }
+    if(out_b != from_b) { memcpy(out_b, from_b, numLEDs); }
+    return;
+  }
+
+  const uint8_t* gammaR = profile->gammaR;
+  const uint8_t* gammaG = profile->gammaG;
+  const uint8_t* gammaB = profile->gammaB;
+  const uint8_t* reverseGammaR = profile->reverseGammaR;
+  const uint8_t* reverseGammaG = profile->reverseGammaG;
+  const uint8_t* reverseGammaB = profile->reverseGammaB;
+
+  CRGB lastFrom(0, 0, 0), lastTo(0, 0, 0), lastOut(0, 0, 0);
+  uint8_t lastFromB = 0, lastToB = 0, lastOutB = 0;
+  bool haveLast = false;
   for(uint16_t i = 0; i < numLEDs; i++) {
-    if(leds_b[i] == 0) {
-      leds_5bit_brightness[i] = 0;
+    CRGB from = fromLeds[i];
+    CRGB to = toLeds[i];
+    uint8_t fromB = from_b[i];
+    uint8_t toB = to_b[i];
+    if(haveLast && fromB == lastFromB && toB == lastToB && from == lastFrom && to == lastTo) {
+      outLeds[i] = lastOut;
+      out_b[i] = lastOutB;
+      continue;
+    }
+    haveLast = true;
+    lastFrom = from;
+    lastTo = to;
+    lastFromB = fromB;
+    lastToB = toB;
+
+    fract8 colorAmount = amount;
+    if(fromB == toB) {
+      lastOutB = fromB;
     }
     else {
-      uint16_t brightness = *globalBrightness * leds_b[i] / 0xFF;
-      if(brightness == 0) { brightness = 1; }
-      leds_5bit_brightness[i] = pgm_read_byte(&gammaDim_5bit[brightness]);
-
-      // Dimming logic; all done linearly
-      uint8_t dimAmount = pgm_read_byte(&gammaDim[brightness]);
-      CRGB correction = colorCorrections[leds_5bit_brightness[i]];
-      correction.nscale8_video(dimAmount);
-      leds[i].nscale8(correction); 
-      
-      #ifdef ENABLE_COLOR_CORRECTION_TESTS
-        if(useLookupMatrices) {
-            Correct(leds[i]);
-        }
-        else {
-          leds[i].r = applyGamma_video(leds[i].r, fGammaR);
-          leds[i].g = applyGamma_video(leds[i].g, fGammaG);
-          leds[i].b = applyGamma_video(leds[i].b, fGammaB);
-        }
-      #else
-        Correct(leds[i]);
-      #endif
+      uint32_t fromLight = uint32_t(255 - amount) * DimLight(fromB);
+      uint32_t toLight = uint32_t(amount) * DimLight(toB);
+      lastOutB = DimLevelForLight((fromLight + toLight) / 255);
+      if(fromLight + toLight > 0) { colorAmount = toLight * 255 / (fromLight + toLight); }
     }
+
+    // Endpoints are copied rather than round tripped through the matrices
+    if(from == to || colorAmount == 0) {
+      lastOut = from;
+    }
+    else if(colorAmount == 255) {
+      lastOut = to;
+    }
+    else {
+      lastOut.r = pgm_read_byte(&gammaR[blend8(pgm_read_byte(&reverseGammaR[from.r]), pgm_read_byte(&reverseGammaR[to.r]), colorAmount)]);
+      lastOut.g = pgm_read_byte(&gammaG[blend8(pgm_read_byte(&reverseGammaG[from.g]), pgm_read_byte(&reverseGammaG[to.g]), colorAmount)]);
+      lastOut.b = pgm_read_byte(&gammaB[blend8(pgm_read_byte(&reverseGammaB[from.b]), pgm_read_byte(&reverseGammaB[to.b]), colorAmount)]);
+    }
+    outLeds[i] = lastOut;
+    out_b[i] = lastOutB;
   }
 }
 
+// Moves *globalBrightness to target over durationMs, one step per Prep call. Writing *globalBrightness directly cancels the ramp
+void GammaManager::RampBrightness(uint8_t target, uint32_t durationMs) {
+  rampFrom = *globalBrightness;
+  rampCurrent = rampFrom;
+  rampTarget = target;
+  rampStartMs = millis();
+  rampDurationMs = durationMs;
+  rampActive = true;
+}
 
-#ifdef ENABLE_COLOR_CORRECTION_TESTS
-// The main test loop with serial IO
-void GammaManager::RunTests(uint16_t thickness, uint16_t gradientLength) {
-  static uint8_t curMode = 0;
-  *globalBrightness = INITIAL_TEST_BRIGHTNESS;
-  for(uint16_t i = 0; i < numLEDs; i++) { leds_b[i] = 255; }
+bool GammaManager::IsRamping() {
+  return rampActive;
+}
+
+// Sets *globalBrightness for the current time in the ramp, if one is running
+void GammaManager::AdvanceBrightnessRamp() {
+  if(!rampActive) { return; }
+  if(*globalBrightness != rampCurrent) {
+    rampActive = false;
+    return;
+  }
+
+  // NeedsFullRedraw() asked for every pixel, whether or not this step changes the brightness
+  if(PrepsInPlace()) { MarkAllDirty(); }
+
+  uint32_t elapsed = millis() - rampStartMs;
+  if(elapsed >= rampDurationMs) {
+    rampCurrent = rampTarget;
+    rampActive = false;
+  }
+  else {
+    // 64-bit, since scheduled dimming runs for hours and distance * elapsed passes 32 bits after about 2.3
+    uint8_t distance = rampTarget > rampFrom ? rampTarget - rampFrom : rampFrom - rampTarget;
+    uint8_t moved = uint64_t(distance) * elapsed / rampDurationMs;
+    rampCurrent = rampTarget > rampFrom ? rampFrom + moved : rampFrom - moved;
+  }
+  *globalBrightness = rampCurrent;
+}
+
+// Adds one output pixel to the per-channel power sums
+static inline void AddPower(uint32_t* power, const CRGB& pixel, uint8_t brightness5bit) {
+  power[0] += pixel.r * brightness5bit;
+  power[1] += pixel.g * brightness5bit;
+  power[2] += pixel.b * brightness5bit;
+}
+
+// globalBrightness, lowered when needed to stay within the power limit
+inline uint8_t GammaManager::FrameBrightness() {
+  return *globalBrightness < powerLimitBrightness ? *globalBrightness : powerLimitBrightness;
+}
+
+// Estimates the strip's current from each Prep's output, in the same pass; see GetEstimatedMilliamps(). Prep then makes full passes
+// with dirty tracking, so NeedsFullRedraw() asks for every frame when Prep works in place
+void GammaManager::EnablePowerEstimate(bool enable) {
+  measurePower = enable;
+  if(!enable) {
+    maxMilliamps = 0;
+    powerLimitBrightness = 255;
+  }
+}
+
+// Current drawn per LED by each channel at full value and 5-bit brightness 31, and by a dark LED. Defaults match FastLED's 5V figures
+void GammaManager::SetPowerModel(uint8_t redMilliamps, uint8_t greenMilliamps, uint8_t blueMilliamps, uint8_t idleMilliamps) {
+  powerModel[0] = redMilliamps;
+  powerModel[1] = greenMilliamps;
+  powerModel[2] = blueMilliamps;
+  powerModel[3] = idleMilliamps;
+}
+
+// Keeps the estimated current under maxMilliamps by lowering the brightness Prep uses, along the gammaDim curve. *globalBrightness
+// is left alone. Each frame's estimate sets the next frame's brightness, so a sudden jump in content can exceed the limit for one frame. 0 removes the limit
+void GammaManager::SetPowerLimit(uint32_t _maxMilliamps) {
+  maxMilliamps = _maxMilliamps;
+  powerLimitBrightness = 255;
+  if(maxMilliamps > 0) { measurePower = true; }
+}
+
+// Estimated current of the last frame Prep produced
+uint32_t GammaManager::GetEstimatedMilliamps() {
+  return estimatedMilliamps;
+}
+
+void GammaManager::BeginPowerEstimate() {
+  if(measurePower) { memset(powerSums, 0, sizeof(powerSums)); }
+}
+
+// Converts the frame's power sums to milliamps and, with a limit set, picks the brightness for the next frame
+void GammaManager::EndPowerEstimate() {
+  if(!measurePower) { return; }
+  uint32_t idle = uint32_t(numLEDs) * powerModel[3];
+  uint32_t driven = (uint64_t(powerSums[0]) * powerModel[0] + uint64_t(powerSums[1]) * powerModel[1] + uint64_t(powerSums[2]) * powerModel[2]) / (255 * 31);
+  estimatedMilliamps = idle + driven;
+  if(maxMilliamps == 0) { return; }
+
+  uint8_t current = FrameBrightness();
+  if(maxMilliamps <= idle) {
+    powerLimitBrightness = 0;
+    return;
+  }
+  if(driven == 0 || current == 0) {
+    powerLimitBrightness = 255;
+    return;
+  }
+
+  // Gamma is applied after dimming, so current changes faster than the gammaDim light curve. Scaling light down by the overage
+  // therefore lands within the budget; scaling it up by the square root of the headroom approaches the budget without overshooting
+  uint32_t allowed = maxMilliamps - idle;
+  float ratio = float(allowed) / float(driven);
+  if(ratio > 1) { ratio = sqrtf(ratio); }
+  float light = DimLight(current) * ratio;
+  if(light >= DimLight(255)) {
+    powerLimitBrightness = 255;
+    return;
+  }
+
+  uint8_t level = DimLevelForLight(uint16_t(light));
+  if(DimLight(level) > light && level > 1) { level--; }
+  powerLimitBrightness = level > 0 ? level : 1;
+}
+
+// True when the frame brightness, colorCorrections or profile changed since the cache was built
+bool GammaManager::PrepCacheStale() {
+  return !prepCacheValid || prepCacheBrightness != FrameBrightness();
+}
+
+// Starts a new cache for the current globalBrightness. Entries are filled as Prep first meets each leds_b value, so a brightness
+// change costs only the levels in use rather than all 255
+void GammaManager::RebuildPrepCache() {
+  memset(prepEntryReady, 0, sizeof(prepEntryReady));
+  prep5bit[0] = 0;
+  prepCorrections[0] = CRGB::Black;
+  prepEntryReady[0] = 1;
+
+  prepCacheBrightness = FrameBrightness();
+  prepCacheValid = true;
+}
+
+// Computes the 5-bit brightness and dimmed color correction for one leds_b value at the current globalBrightness
+void GammaManager::FillPrepEntry(uint8_t level) {
+  uint16_t brightness = FrameBrightness() * level / 0xFF;
+  if(brightness == 0) { brightness = 1; }
+  uint8_t dimAmount;
+  ReadDim(brightness, prep5bit[level], dimAmount);
+
+  // Dimming logic; all done linearly
+  prepCorrections[level] = colorCorrections[prep5bit[level]];
+  prepCorrections[level].nscale8_video(dimAmount);
+  prepEntryReady[level >> 3] |= 1 << (level & 7);
+}
+
+inline void GammaManager::RequirePrepEntry(uint8_t level) {
+  if(!(prepEntryReady[level >> 3] & (1 << (level & 7)))) { FillPrepEntry(level); }
+}
+
+// Fills every entry not yet computed, for code that can't fill them as it goes
+void GammaManager::FillPrepCache() {
+  for(uint16_t i = 1; i <= 255; i++) { RequirePrepEntry(i); }
+}
+
+// When enabled, PrepPixelsForFastLED() only processes pixels passed to MarkDirty(); the rest keep last frame's output.
+// Up to GAMMA_MAX_DIRTY_SPANS separate spans are kept exactly. Past that the closest two merge, and when Prep works in place
+// the pixels between them must be redrawn too; GetDirtySpan() lists what the next Prep will process
+void GammaManager::EnableDirtyTracking(bool enable) {
+  trackDirty = enable;
+  MarkAllDirty();
+}
+
+// Flags pixels that have been rewritten with uncorrected colors since the last PrepPixelsForFastLED()
+void GammaManager::MarkDirty(uint16_t start, uint16_t count) {
+  if(start >= numLEDs || count == 0) { return; }
+  uint16_t end = count > numLEDs - start ? numLEDs : start + count;
+  dirty.Add(start, end);
+}
+
+void GammaManager::MarkAllDirty() {
+  dirty.count = 1;
+  dirty.starts[0] = 0;
+  dirty.ends[0] = numLEDs;
+}
+
+// The index'th span [start, end) marked since the last Prep, in order; false past the last one
+bool GammaManager::GetDirtySpan(uint8_t index, uint16_t& start, uint16_t& end) {
+  if(index >= dirty.count) { return false; }
+  start = dirty.starts[index];
+  end = dirty.ends[index];
+  return true;
+}
+
+// Inserts a span in order, absorbing the spans it overlaps or touches; when that leaves one too many, the two with the smallest gap merge
+void GammaManager::DirtySpans::Add(uint16_t start, uint16_t end) {
+  uint8_t first = 0;
+  while(first < count && ends[first] < start) { first++; }
+  uint8_t last = first;
+  while(last < count && starts[last] <= end) {
+    if(starts[last] < start) { start = starts[last]; }
+    if(ends[last] > end) { end = ends[last]; }
+    last++;
+  }
+  memmove(&starts[first + 1], &starts[last], (count - last) * sizeof(uint16_t));
+  memmove(&ends[first + 1], &ends[last], (count - last) * sizeof(uint16_t));
+  starts[first] = start;
+  ends[first] = end;
+  count = count - (last - first) + 1;
+  if(count <= GAMMA_MAX_DIRTY_SPANS) { return; }
+
+  uint8_t closest = 0;
+  for(uint8_t i = 1; i < count - 1; i++) {
+    if(starts[i + 1] - ends[i] < starts[closest + 1] - ends[closest]) { closest = i; }
+  }
+  ends[closest] = ends[closest + 1];
+  memmove(&starts[closest + 1], &starts[closest + 2], (count - closest - 2) * sizeof(uint16_t));
+  memmove(&ends[closest + 1], &ends[closest + 2], (count - closest - 2) * sizeof(uint16_t));
+  count--;
+}
+
+// True when Prep overwrites leds[] with its own output, rather than reading a separate source or writing separate output buffers
+inline bool GammaManager::PrepsInPlace() {
+  return linearLeds == NULL && packedLeds == NULL && indexedLeds == NULL && outputLeds[0] == NULL;
+}
+
+// With dirty tracking, a brightness or color correction change reprocesses every pixel, so all of leds[] must be redrawn first.
+// A running ramp changes brightness inside the next Prep, after this is asked, so every ramp frame counts as a change. The power
+// estimate needs every pixel's output each frame, so while it runs Prep makes full passes and leds[] must be redrawn for them
+bool GammaManager::NeedsFullRedraw() {
+  if(!PrepsInPlace()) { return false; }
+  return !trackDirty || measurePower || rampActive || PrepCacheStale();
+}
+
+// Effects draw into a 16-bit linear buffer instead of leds[]; PrepPixelsForFastLED() then writes leds[] from it. NULL disables
+void GammaManager::SetLinearBuffer(CRGB16* _linearLeds) {
+  linearLeds = _linearLeds;
+  packedLeds = NULL;
+  indexedLeds = NULL;
+  MarkAllDirty();
+}
+
+// Effects draw color and brightness into one packed buffer instead of leds[] and leds_b[]; Prep then reads a single stream. NULL disables
+void GammaManager::SetPackedBuffer(GammaPixel* _packedLeds) {
+  packedLeds = _packedLeds;
+  linearLeds = NULL;
+  indexedLeds = NULL;
+  MarkAllDirty();
+}
+
+// Effects draw 8-bit indices into palette instead of leds[] and leds_b[]; Prep corrects each palette entry once, into
+// preparedPalette (paletteSize entries, brightness holding the 5-bit value), then copies entries out. NULL disables.
+// With dirty tracking, call MarkAllDirty() after editing the palette
+void GammaManager::SetIndexedBuffer(uint8_t* _indexedLeds, const GammaPixel* _palette, GammaPixel* _preparedPalette, uint16_t _paletteSize) {
+  indexedLeds = _indexedLeds;
+  palette = _palette;
+  preparedPalette = _preparedPalette;
+  paletteSize = _paletteSize;
+  linearLeds = NULL;
+  packedLeds = NULL;
+  MarkAllDirty();
+}
+
+// Prep writes into these buffers instead of leds[]/leds_5bit_brightness; pass a second pair to double buffer. NULL disables
+void GammaManager::SetOutputBuffers(CRGB* out0, uint8_t* out0_5bit_brightness, CRGB* out1, uint8_t* out1_5bit_brightness) {
+  outputLeds[0] = out0;
+  output5bit[0] = out0_5bit_brightness;
+  outputLeds[1] = out0 == NULL ? NULL : out1;
+  output5bit[1] = out0 == NULL ? NULL : out1_5bit_brightness;
+  frontBuffer = backBuffer = 0;
+  fullPrepsPending = 2;
+}
+
+// The buffer filled by the last PrepPixelsForFastLED(), to be handed to FastLED
+CRGB* GammaManager::GetOutputLeds() {
+  return outputLeds[0] == NULL ? leds : outputLeds[frontBuffer];
+}
+
+uint8_t* GammaManager::GetOutput5bitBrightness() {
+  return outputLeds[0] == NULL ? leds_5bit_brightness : output5bit[frontBuffer];
+}
+
+// Converts a previously-corrected color into the linear buffer's format
+CRGB16 GammaManager::Linearize(const CRGB& corrected) {
+  CRGB temp = corrected;
+  Inverse(temp);
+  CRGB16 retVal = { uint16_t(temp.r << 8), uint16_t(temp.g << 8), uint16_t(temp.b << 8) };
+  return retVal;
+}
+
+// Blends two linear buffer pixels; no gamma round trip is needed
+void GammaManager::BlendLinear(CRGB16& a, const CRGB16& b, fract16 blendAmount) {
+  a.r = a.r + (((int32_t(b.r) - a.r) * blendAmount) >> 16);
+  a.g = a.g + (((int32_t(b.g) - a.g) * blendAmount) >> 16);
+  a.b = a.b + (((int32_t(b.b) - a.b) * blendAmount) >> 16);
+}
+
+// Final gamma step of PrepPixelsForFastLED()
+inline void GammaManager::ApplyOutputGamma(CRGB& pixel) {
+  #ifdef ENABLE_COLOR_CORRECTION_TESTS
+    if(!useLookupMatrices) {
+      pixel.r = tuneGammaR[pixel.r];
+      pixel.g = tuneGammaG[pixel.g];
+      pixel.b = tuneGammaB[pixel.b];
+      return;
+    }
+  #endif
+  if(interleavedTables != NULL) {
+    pixel.r = pgm_read_byte(&interleavedTables->rgb[pixel.r][0]);
+    pixel.g = pgm_read_byte(&interleavedTables->rgb[pixel.g][1]);
+    pixel.b = pgm_read_byte(&interleavedTables->rgb[pixel.b][2]);
+  }
+  else {
+    Correct(pixel);
+  }
+}
+
+// Gamma lookup of a 16-bit value, interpolating between adjacent table entries
+static inline uint8_t Gamma16(const uint8_t* table, uint16_t value, uint8_t stride = 1) {
+  uint8_t index = value >> 8;
+  uint8_t lower = pgm_read_byte(&table[index * stride]);
+  if(index == 255) { return lower; }
+  uint8_t upper = pgm_read_byte(&table[(index + 1) * stride]);
+  return lower + (((upper - lower) * (value & 0xFF)) >> 8);
+}
+
+// Final gamma step of PrepPixelsForFastLED() for linear buffer pixels
+inline void GammaManager::ApplyOutputGamma16(uint16_t r, uint16_t g, uint16_t b, CRGB& out) {
+  #ifdef ENABLE_COLOR_CORRECTION_TESTS
+    if(!useLookupMatrices) {
+      out.r = tuneGammaR[r >> 8];
+      out.g = tuneGammaG[g >> 8];
+      out.b = tuneGammaB[b >> 8];
+      return;
+    }
+  #endif
+  if(interleavedTables != NULL) {
+    out.r = Gamma16(&interleavedTables->rgb[0][0], r, 4);
+    out.g = Gamma16(&interleavedTables->rgb[0][1], g, 4);
+    out.b = Gamma16(&interleavedTables->rgb[0][2], b, 4);
+    return;
+  }
+  out.r = Gamma16(profile->gammaR, r);
+  out.g = Gamma16(profile->gammaG, g);
+  out.b = Gamma16(profile->gammaB, b);
+}
+
+void GammaManager::PrepPixelsForFastLED() {
+  AdvanceBrightnessRamp();
+  BeginPowerEstimate();
+  #ifdef ENABLE_GAMMA_STATS
+    uint32_t startTicks = GAMMA_STATS_TICKS();
+    PrepFrame();
+    RecordPrepStats(GAMMA_STATS_TICKS() - startTicks);
+  #else
+    PrepFrame();
+  #endif
+  EndPowerEstimate();
+}
+
+void GammaManager::PrepFrame() {
+  CRGB* out = leds;
+  uint8_t* out5bit = leds_5bit_brightness;
+  if(outputLeds[0] != NULL) {
+    out = outputLeds[backBuffer];
+    out5bit = output5bit[backBuffer];
+    frontBuffer = backBuffer;
+    if(outputLeds[1] != NULL) { backBuffer ^= 1; }
+  }
+
+  if(FrameBrightness() == 0) {
+    memset(out5bit, 0, numLEDs);
+    prepCacheValid = false;
+    #ifdef ENABLE_GAMMA_STATS
+      statsLevels[0] += numLEDs;
+    #endif
+    return;
+  }
+
+  uint32_t* power = measurePower ? powerSums : NULL;
+  UpdatePrepCache();
+  PreparePalette();
+
+  // The power estimate covers the whole frame, so measuring turns off dirty tracking's partial passes
+  DirtySpans spans;
+  spans.Add(0, numLEDs);
+  if(fullPrepsPending > 0) {
+    fullPrepsPending--;
+  }
+  else if(trackDirty && !measurePower) {
+    spans = dirty;
+    if(outputLeds[1] != NULL) {
+      // The back buffer was last written two frames ago, so it also needs last frame's changes
+      for(uint8_t i = 0; i < prevDirty.count; i++) { spans.Add(prevDirty.starts[i], prevDirty.ends[i]); }
+    }
+  }
+  prevDirty = dirty;
+  dirty.count = 0;
+
+  for(uint8_t i = 0; i < spans.count; i++) { PrepSpan(out, out5bit, spans.starts[i], spans.ends[i], power); }
+}
+
+// Preps pixels first to last of the source into out/out5bit, split with the worker core when parallel Prep is on and the span is large
+void GammaManager::PrepSpan(CRGB* out, uint8_t* out5bit, uint16_t first, uint16_t last, uint32_t* power) {
+  // The worker can't share statsLevels, so stats builds always prep serially
+  #if defined(GAMMA_PARALLEL_PREP) && !defined(ENABLE_GAMMA_STATS)
+    if(parallelPrep && last > first && last - first >= PARALLEL_PREP_MIN_PIXELS) {
+      // Both cores read the cache, so it is completed up front rather than filled as they go
+      FillPrepCache();
+      uint16_t mid = first + (last - first) / 2;
+      workerOut = &out[mid];
+      workerOut5bit = &out5bit[mid];
+      workerFirst = mid;
+      workerLast = last;
+      workerMeasuresPower = power != NULL;
+      xSemaphoreGive(prepWorkerStart);
+      PrepSourceRange(&out[first], &out5bit[first], first, mid, power);
+      xSemaphoreTake(prepWorkerDone, portMAX_DELAY);
+      if(power != NULL) {
+        for(uint8_t c = 0; c < 3; c++) { power[c] += workerPower[c]; }
+      }
+      return;
+    }
+  #endif
+
+  PrepSourceRange(&out[first], &out5bit[first], first, last, power);
+}
+
+// Splits large Prep calls between this core and a worker task on the other core. No effect on single-core builds
+void GammaManager::EnableParallelPrep(bool enable) {
+  #ifdef GAMMA_PARALLEL_PREP
+    if(enable && prepWorker == NULL) {
+      prepWorkerStart = xSemaphoreCreateBinary();
+      prepWorkerDone = xSemaphoreCreateBinary();
+      BaseType_t otherCore = xPortGetCoreID() == 0 ? 1 : 0;
+      xTaskCreatePinnedToCore(PrepWorkerTask, "GammaPrep", 2048, this, uxTaskPriorityGet(NULL), &prepWorker, otherCore);
+    }
+    parallelPrep = enable && prepWorker != NULL;
+  #else
+    (void)enable;
+  #endif
+}
+
+#ifdef ENABLE_GAMMA_STATS
+const GammaStats& GammaManager::GetStats() {
+  return stats;
+}
+
+void GammaManager::ResetStats() {
+  memset(&stats, 0, sizeof(stats));
+  memset(statsLevels, 0, sizeof(statsLevels));
+}
+
+// Folds the per-level pixel counts of the last Prep call into stats
+void GammaManager::RecordPrepStats(uint32_t ticks) {
+  if(stats.prepCount == 0 || ticks < stats.minTicks) { stats.minTicks = ticks; }
+  if(ticks > stats.maxTicks) { stats.maxTicks = ticks; }
+  stats.totalTicks += ticks;
+  stats.prepCount++;
+  uint8_t bucket = 0;
+  while(bucket < 31 && (ticks >> (bucket + 1)) != 0) { bucket++; }
+  stats.ticksHistogram[bucket]++;
+
+  stats.blackPixels += statsLevels[0];
+  for(uint16_t i = 1; i <= 255; i++) {
+    if(statsLevels[i] == 0) { continue; }
+    stats.litPixels += statsLevels[i];
+    if(FrameBrightness() * i / 0xFF == 0) { stats.clampedPixels += statsLevels[i]; }
+    stats.brightnessHistogram[prep5bit[i]] += statsLevels[i];
+  }
+  memset(statsLevels, 0, sizeof(statsLevels));
+}
+
+void GammaManager::PrintStats(Print& out) {
+  out.println("Prep calls: " + String(stats.prepCount) + ", ticks min/avg/max: " + String(stats.minTicks) + "/" +
+    String(stats.prepCount == 0 ? 0 : uint32_t(stats.totalTicks / stats.prepCount)) + "/" + String(stats.maxTicks));
+  out.print("Ticks histogram (2^n):");
+  for(uint8_t i = 0; i < 32; i++) {
+    if(stats.ticksHistogram[i] > 0) { out.print(" " + String(i) + ":" + String(stats.ticksHistogram[i])); }
+  }
+  out.println();
+  out.println("Pixels lit: " + String(stats.litPixels) + ", black: " + String(stats.blackPixels) + ", clamped to 1: " + String(stats.clampedPixels));
+  out.print("5-bit brightness histogram:");
+  for(uint8_t i = 0; i < 32; i++) {
+    if(stats.brightnessHistogram[i] > 0) { out.print(" " + String(i) + ":" + String(stats.brightnessHistogram[i])); }
+  }
+  out.println();
+}
+#endif
 
+#ifdef GAMMA_PARALLEL_PREP
+void GammaManager::PrepWorkerTask(void* param) {
+  GammaManager* gm = (GammaManager*)param;
   while(true) {
-    if(curMode == 0) {
-      // The most common test; A gradient of RGB at the start and a gradient of HSV at the end
-      RunGradientTest(leds, leds_b, numLEDs, gradientLength);
-    }
-    else if(curMode == 1) { 
-      // A single pattern of RGB
-      if(numLEDs > 6*(thickness+1)) { RunSimpleTest(leds, leds_b, 3*(thickness+1), thickness); }
-    }
-    else if(curMode == 2) {
-      // A repeating pattern of RGB
-      RunSimpleTest(leds, leds_b, numLEDs, thickness);
-    }
-    else if(curMode == 3) {
-      // A single strip of white
-      RunWhiteTest(leds, leds_b, min(uint16_t(numLEDs), uint16_t(2*thickness)), 0); // todo: investigate this: this is a hack to get around a bug in the esp libraries
-	    if(numLEDs > 4*thickness) {
-        RunWhiteTest(&leds[numLEDs-2*thickness], &leds_b[numLEDs-2*thickness], 2*thickness, 0);
+    xSemaphoreTake(gm->prepWorkerStart, portMAX_DELAY);
+    memset(gm->workerPower, 0, sizeof(gm->workerPower));
+    gm->PrepSourceRange(gm->workerOut, gm->workerOut5bit, gm->workerFirst, gm->workerLast, gm->workerMeasuresPower ? gm->workerPower : NULL);
+    xSemaphoreGive(gm->prepWorkerDone);
+  }
+}
+#endif
+
+// Rebuilds the per-leds_b cache if needed; every output buffer then needs one full pass
+void GammaManager::UpdatePrepCache() {
+  if(PrepCacheStale()) {
+    RebuildPrepCache();
+    fullPrepsPending = outputLeds[1] != NULL ? 2 : 1;
+  }
+}
+
+// Size in bytes of the buffer PrepAPA102Frame() fills
+uint32_t GammaManager::APA102FrameSize() {
+  return 4 + 4*uint32_t(numLEDs) + 4 + (numLEDs + 15) / 16;
+}
+
+// Prep variant that writes the finished APA102/SK9822 SPI frame straight into frame[]; leds[] is left untouched
+uint32_t GammaManager::PrepAPA102Frame(uint8_t* frame, EOrder order) {
+  AdvanceBrightnessRamp();
+  PreparePalette();
+  BeginPowerEstimate();
+  uint8_t* p = frame;
+  memset(p, 0, 4); // Start frame
+  #ifdef ENABLE_GAMMA_STATS
+    uint32_t startTicks = GAMMA_STATS_TICKS();
+    p = EncodeAPA102(p + 4, 0, numLEDs, order);
+    RecordPrepStats(GAMMA_STATS_TICKS() - startTicks);
+  #else
+    p = EncodeAPA102(p + 4, 0, numLEDs, order);
+  #endif
+  EndPowerEstimate();
+
+  // End frame: an SK9822 reset frame, then numLEDs/2 bits of zeros to clock data through the chain
+  uint16_t endBytes = 4 + (numLEDs + 15) / 16;
+  memset(p, 0, endBytes);
+  return (p + endBytes) - frame;
+}
+
+// Streams the APA102 frame to sink in chunks, correcting the next chunk while the sink transmits the last one.
+// buffer0 and buffer1 must each hold 4*chunkPixels bytes. A chunk's length must fit the sink's 16-bit length, so chunkPixels
+// must be 1 to APA102_MAX_CHUNK_PIXELS; otherwise nothing is sent
+void GammaManager::PrepAPA102Pipelined(uint8_t* buffer0, uint8_t* buffer1, uint16_t chunkPixels, APA102ChunkSink sink, void* context, EOrder order) {
+  if(chunkPixels == 0 || chunkPixels > APA102_MAX_CHUNK_PIXELS) { return; }
+  uint8_t* buffers[2] = { buffer0, buffer1 };
+  uint8_t cur = 0;
+  uint16_t bufferSize = 4*chunkPixels;
+  AdvanceBrightnessRamp();
+  PreparePalette();
+  BeginPowerEstimate();
+
+  memset(buffers[cur], 0, 4); // Start frame
+  sink(buffers[cur], 4, context);
+  cur ^= 1;
+
+  #ifdef ENABLE_GAMMA_STATS
+    uint32_t encodeTicks = 0;
+  #endif
+  for(uint32_t start = 0; start < numLEDs; start += chunkPixels) {
+    uint16_t end = numLEDs - start < chunkPixels ? numLEDs : start + chunkPixels;
+    #ifdef ENABLE_GAMMA_STATS
+      uint32_t startTicks = GAMMA_STATS_TICKS();
+      EncodeAPA102(buffers[cur], start, end, order);
+      encodeTicks += GAMMA_STATS_TICKS() - startTicks;
+    #else
+      EncodeAPA102(buffers[cur], start, end, order);
+    #endif
+    sink(buffers[cur], 4*(end - start), context);
+    cur ^= 1;
+  }
+  #ifdef ENABLE_GAMMA_STATS
+    RecordPrepStats(encodeTicks); // Time spent in the sink is left out
+  #endif
+  EndPowerEstimate();
+
+  // End frame, as in PrepAPA102Frame()
+  uint16_t remaining = 4 + (numLEDs + 15) / 16;
+  while(remaining > 0) {
+    uint16_t length = remaining < bufferSize ? remaining : bufferSize;
+    memset(buffers[cur], 0, length);
+    sink(buffers[cur], length, context);
+    cur ^= 1;
+    remaining -= length;
+  }
+
+  sink(NULL, 0, context);
+}
+
+// Writes the 4-byte LED frames for pixels [first..last), corrected in small chunks so intermediate values stay in cache
+uint8_t* GammaManager::EncodeAPA102(uint8_t* frame, uint16_t first, uint16_t last, EOrder order) {
+  const uint16_t CHUNK_SIZE = 32;
+  CRGB chunk[CHUNK_SIZE];
+  uint8_t chunk5bit[CHUNK_SIZE];
+  const uint8_t byte0 = RGB_BYTE0(order);
+  const uint8_t byte1 = RGB_BYTE1(order);
+  const uint8_t byte2 = RGB_BYTE2(order);
+
+  bool dark = FrameBrightness() == 0;
+  if(!dark) { UpdatePrepCache(); }
+
+  for(uint16_t start = first; start < last; start += CHUNK_SIZE) {
+    uint16_t count = last - start < CHUNK_SIZE ? last - start : CHUNK_SIZE;
+    if(dark) {
+      memset(chunk5bit, 0, count);
+      #ifdef ENABLE_GAMMA_STATS
+        statsLevels[0] += count;
+      #endif
+    }
+    else { PrepSourceRange(chunk, chunk5bit, start, start + count, measurePower ? powerSums : NULL); }
+
+    for(uint16_t j = 0; j < count; j++) {
+      if(chunk5bit[j] == 0) {
+        frame[0] = 0xE0;
+        frame[1] = frame[2] = frame[3] = 0;
+      }
+      else {
+        frame[0] = 0xE0 | chunk5bit[j];
+        frame[1] = chunk[j].raw[byte0];
+        frame[2] = chunk[j].raw[byte1];
+        frame[3] = chunk[j].raw[byte2];
       }
+      frame += 4;
     }
-    else if(curMode == 4) {
-      // White every third pixel
-      RunWhiteTest(leds, leds_b, numLEDs, 2);
+  }
+
+  return frame;
+}
+
+static inline bool operator==(const CRGB16& a, const CRGB16& b) {
+  return a.r == b.r && a.g == b.g && a.b == b.b;
+}
+
+// Scales and corrects source pixels [first..last) into out[0..last-first), which may be the source itself. Shared by every
+// source layout; Source reads a pixel's leds_b level and its color (Key, compared for run reuse) and corrects the color
+template<typename Source> inline void GammaManager::PrepRangeFrom(const Source& source, CRGB* out, uint8_t* out5bit, uint16_t first, uint16_t last, uint32_t* power) {
+  if(first >= last) { return; }
+
+  // Runs of identical input pixels reuse the previous result instead of repeating the lookups. lastB starts at 0, a level no
+  // lit pixel has, so the first pixel is always corrected
+  typename Source::Key lastIn = source.Read(first);
+  CRGB lastOut;
+  uint8_t lastB = 0;
+  uint16_t i = first;
+  while(i < last) {
+    uint8_t b = source.Level(i);
+    if(b == 0) {
+      uint16_t runEnd = i + 1;
+      while(runEnd < last && source.Level(runEnd) == 0) { runEnd++; }
+      memset(&out5bit[i - first], 0, runEnd - i);
+      #ifdef ENABLE_GAMMA_STATS
+        statsLevels[0] += runEnd - i;
+      #endif
+      i = runEnd;
+      continue;
     }
-    else if(curMode == 5) {
-      // White every pixel
-      RunWhiteTest(leds, leds_b, numLEDs, 0);
+
+    typename Source::Key in = source.Read(i);
+    if(b != lastB || !(in == lastIn)) {
+      if(b != lastB) { RequirePrepEntry(b); }
+      lastB = b;
+      lastIn = in;
+      lastOut = source.Correct(in, b);
     }
-    else if(curMode == 6) {
-      // One stripe of colors with middle colors drawn; brightness derived from gammaDim
-      RunMidpointTest(leds, leds_b, numLEDs, thickness, true);
+    out[i - first] = lastOut;
+    out5bit[i - first] = prep5bit[b];
+    #ifdef ENABLE_GAMMA_STATS
+      statsLevels[b]++;
+    #endif
+    if(power != NULL) { AddPower(power, lastOut, prep5bit[b]); }
+    i++;
+  }
+}
+
+// leds[] and leds_b[]
+struct GammaManager::CRGBSource {
+  GammaManager* gm;
+  const CRGB* leds;
+  const uint8_t* leds_b;
+  typedef CRGB Key;
+
+  CRGBSource(GammaManager* _gm) : gm(_gm), leds(_gm->leds), leds_b(_gm->leds_b) {}
+  uint8_t Level(uint16_t i) const { return leds_b[i]; }
+  CRGB Read(uint16_t i) const { return leds[i]; }
+  CRGB Correct(CRGB color, uint8_t b) const {
+    color.nscale8(gm->prepCorrections[b]);
+    gm->ApplyOutputGamma(color);
+    return color;
+  }
+};
+
+// linearLeds[] and leds_b[]; gamma is applied once, at 16-bit precision
+struct GammaManager::LinearSource {
+  GammaManager* gm;
+  const CRGB16* linearLeds;
+  const uint8_t* leds_b;
+  typedef CRGB16 Key;
+
+  LinearSource(GammaManager* _gm) : gm(_gm), linearLeds(_gm->linearLeds), leds_b(_gm->leds_b) {}
+  uint8_t Level(uint16_t i) const { return leds_b[i]; }
+  CRGB16 Read(uint16_t i) const { return linearLeds[i]; }
+  CRGB Correct(const CRGB16& in, uint8_t b) const {
+    const CRGB& correction = gm->prepCorrections[b];
+    CRGB color;
+    gm->ApplyOutputGamma16((uint32_t(in.r) * (correction.r + 1)) >> 8,
+                           (uint32_t(in.g) * (correction.g + 1)) >> 8,
+                           (uint32_t(in.b) * (correction.b + 1)) >> 8, color);
+    return color;
+  }
+};
+
+// packedLeds[]; each pixel is one aligned word load, compared whole for run reuse
+struct GammaManager::PackedSource {
+  GammaManager* gm;
+  const GammaPixel* packedLeds;
+  typedef uint32_t Key;
+
+  PackedSource(GammaManager* _gm) : gm(_gm), packedLeds(_gm->packedLeds) {}
+  uint8_t Level(uint16_t i) const { return packedLeds[i].brightness; }
+  uint32_t Read(uint16_t i) const { return packedLeds[i].raw; }
+  CRGB Correct(uint32_t raw, uint8_t b) const {
+    GammaPixel pixel;
+    pixel.raw = raw;
+    CRGB color(pixel.r, pixel.g, pixel.b);
+    color.nscale8(gm->prepCorrections[b]);
+    gm->ApplyOutputGamma(color);
+    return color;
+  }
+};
+
+// indexedLeds[]; every pixel is a copy of its entry in preparedPalette, filled by PreparePalette()
+struct GammaManager::IndexedSource {
+  const uint8_t* indexedLeds;
+  const GammaPixel* palette;
+  const GammaPixel* preparedPalette;
+  typedef uint8_t Key;
+
+  IndexedSource(GammaManager* gm) : indexedLeds(gm->indexedLeds), palette(gm->palette), preparedPalette(gm->preparedPalette) {}
+  uint8_t Level(uint16_t i) const { return palette[indexedLeds[i]].brightness; }
+  uint8_t Read(uint16_t i) const { return indexedLeds[i]; }
+  CRGB Correct(uint8_t index, uint8_t) const {
+    const GammaPixel& entry = preparedPalette[index];
+    return CRGB(entry.r, entry.g, entry.b);
+  }
+};
+
+// Prep for whichever buffer effects draw into. power, when not NULL, accumulates each channel's output times its 5-bit brightness
+void GammaManager::PrepSourceRange(CRGB* out, uint8_t* out5bit, uint16_t first, uint16_t last, uint32_t* power) {
+  if(linearLeds != NULL) { PrepRangeFrom(LinearSource(this), out, out5bit, first, last, power); }
+  else if(packedLeds != NULL) { PrepRangeFrom(PackedSource(this), out, out5bit, first, last, power); }
+  else if(indexedLeds != NULL) { PrepRangeFrom(IndexedSource(this), out, out5bit, first, last, power); }
+  else { PrepRangeFrom(CRGBSource(this), out, out5bit, first, last, power); }
+}
+
+// Dims, color corrects and gamma corrects each palette entry for the current frame
+void GammaManager::PreparePalette() {
+  if(indexedLeds == NULL || FrameBrightness() == 0) { return; }
+  UpdatePrepCache();
+  for(uint16_t p = 0; p < paletteSize; p++) {
+    GammaPixel entry = palette[p];
+    uint8_t b = entry.brightness;
+    if(b == 0) {
+      preparedPalette[p].raw = 0;
+      continue;
     }
-    else if(curMode == 7) {
-      // Stripes of colors with middle colors drawn; brightness derived from gammaDim
-      RunMidpointTest(leds, leds_b, numLEDs, thickness);
+
+    RequirePrepEntry(b);
+    CRGB color(entry.r, entry.g, entry.b);
+    color.nscale8(prepCorrections[b]);
+    ApplyOutputGamma(color);
+    preparedPalette[p].r = color.r;
+    preparedPalette[p].g = color.g;
+    preparedPalette[p].b = color.b;
+    preparedPalette[p].brightness = prep5bit[b];
+  }
+}
+
+// Memory the binary protocol uploads tables into: 8*256 bytes, in GammaProfile order. Uploads need a target where pgm_read_byte can read RAM
+void GammaManager::SetTableUploadBuffer(uint8_t* storage) {
+  uploadedTables = storage;
+}
+
+// Handles whatever binary protocol input is available without waiting; call as often as frames are expected. Returns after a
+// packet that isn't followed straight away by another sync byte, leaving the rest of the input for the caller
+void GammaManager::ProcessBinaryInput(Stream& stream) {
+  while(stream.available() > 0) {
+    uint8_t c = stream.read();
+    switch(binaryState) {
+      case BINARY_SYNC:
+        if(c == GAMMA_BINARY_SYNC) { binaryState = BINARY_COMMAND; }
+        break;
+      case BINARY_COMMAND:
+        binaryCommand = c;
+        binarySum = c;
+        binaryState = BINARY_LENGTH_LO;
+        break;
+      case BINARY_LENGTH_LO:
+        binaryLength = c;
+        binarySum += c;
+        binaryState = BINARY_LENGTH_HI;
+        break;
+      case BINARY_LENGTH_HI:
+        binaryLength |= c << 8;
+        binarySum += c;
+        binaryPos = 0;
+        binaryState = binaryLength > 0 ? BINARY_PAYLOAD : BINARY_CHECKSUM;
+        break;
+      case BINARY_PAYLOAD:
+        binarySum += c;
+        HandleBinaryPayloadByte(c);
+        if(++binaryPos == binaryLength) { binaryState = BINARY_CHECKSUM; }
+        break;
+      case BINARY_CHECKSUM:
+        binaryState = BINARY_SYNC;
+        if(uint8_t(binarySum + c) != 0) {
+          uint8_t status = GAMMA_STATUS_BAD_CHECKSUM;
+          SendBinaryReply(stream, binaryCommand | 0x80, &status, 1);
+        }
+        else {
+          HandleBinaryPacket(stream);
+        }
+        if(stream.peek() != GAMMA_BINARY_SYNC) { return; }
+        break;
     }
-    else if(curMode == 8) {
-      // One long stretch of white to see how overall dimming works
-      RunDimmingTest(leds, leds_b, numLEDs, gradientLength);
+  }
+}
+
+// Stores one payload byte directly at its destination
+void GammaManager::HandleBinaryPayloadByte(uint8_t c) {
+  if(binaryCommand == GAMMA_CMD_FRAME) {
+    if(binaryPos < 2) {
+      if(binaryPos == 0) { binaryStart = c; }
+      else { binaryStart |= c << 8; }
+      return;
+    }
+
+    uint32_t pixel = binaryStart + (binaryPos - 2) / 4;
+    uint8_t channel = (binaryPos - 2) % 4;
+    if(pixel >= numLEDs || linearLeds != NULL || indexedLeds != NULL) { return; }
+    if(packedLeds != NULL) {
+      ((uint8_t*)&packedLeds[pixel])[channel] = c;
+    }
+    else if(channel == 3) {
+      leds_b[pixel] = c;
     }
+    else {
+      leds[pixel].raw[channel] = c;
+    }
+  }
+  else if(binaryCommand == GAMMA_CMD_TABLE) {
+    if(binaryPos == 0) { binaryTable = c; }
+    else if(uploadedTables != NULL && binaryTable < 8 && binaryPos <= 256) { uploadedTables[256*binaryTable + binaryPos - 1] = c; }
+  }
+  else if(binaryCommand == GAMMA_CMD_BRIGHTNESS) {
+    if(binaryPos == 0) { binaryTable = c; }
+  }
+}
+
+// Acts on a complete packet whose checksum passed
+void GammaManager::HandleBinaryPacket(Stream& stream) {
+  uint8_t status = GAMMA_STATUS_OK;
+  if(binaryCommand == GAMMA_CMD_FRAME) {
+    // Frames carry 8-bit colors and leds_b, which the linear and indexed buffers don't hold
+    if(binaryLength < 2 || linearLeds != NULL || indexedLeds != NULL) { status = GAMMA_STATUS_BAD_PACKET; }
+    else { MarkDirty(binaryStart, (binaryLength - 2 + 3) / 4); }
+  }
+  else if(binaryCommand == GAMMA_CMD_SHOW) {
+    PrepPixelsForFastLED();
+    FastLED.show();
+  }
+  else if(binaryCommand == GAMMA_CMD_TABLE) {
+    if(uploadedTables == NULL || binaryLength != 257 || binaryTable >= 8) {
+      status = GAMMA_STATUS_BAD_PACKET;
+    }
+    else if(profile != &uploadedProfile) {
+      // First upload; start from the current profile so the other tables stay as they are
+      const uint8_t* tables[8] = { profile->gammaR, profile->gammaG, profile->gammaB,
+        profile->reverseGammaR, profile->reverseGammaG, profile->reverseGammaB, profile->gammaDim_5bit, profile->gammaDim };
+      for(uint8_t t = 0; t < 8; t++) {
+        if(t == binaryTable) { continue; }
+        for(uint16_t i = 0; i < 256; i++) { uploadedTables[256*t + i] = pgm_read_byte(&tables[t][i]); }
+      }
+      uploadedProfile.gammaR = &uploadedTables[0];
+      uploadedProfile.gammaG = &uploadedTables[256];
+      uploadedProfile.gammaB = &uploadedTables[512];
+      uploadedProfile.reverseGammaR = &uploadedTables[768];
+      uploadedProfile.reverseGammaG = &uploadedTables[1024];
+      uploadedProfile.reverseGammaB = &uploadedTables[1280];
+      uploadedProfile.gammaDim_5bit = &uploadedTables[1536];
+      uploadedProfile.gammaDim = &uploadedTables[1792];
+      SetProfile(&uploadedProfile);
+    }
+    else {
+      prepCacheValid = false;
+    }
+  }
+  else if(binaryCommand == GAMMA_CMD_STATS) {
+    #ifdef ENABLE_GAMMA_STATS
+      SendBinaryReply(stream, binaryCommand | 0x80, (const uint8_t*)&stats, sizeof(stats));
+      return;
+    #else
+      status = GAMMA_STATUS_BAD_PACKET;
+    #endif
+  }
+  else if(binaryCommand == GAMMA_CMD_BRIGHTNESS && binaryLength == 1) {
+    *globalBrightness = binaryTable;
+  }
+  else {
+    status = GAMMA_STATUS_BAD_PACKET;
+  }
+
+  SendBinaryReply(stream, binaryCommand | 0x80, &status, 1);
+}
+
+void GammaManager::SendBinaryReply(Stream& stream, uint8_t command, const uint8_t* payload, uint16_t length) {
+  uint8_t header[4] = { GAMMA_BINARY_SYNC, command, uint8_t(length & 0xFF), uint8_t(length >> 8) };
+  uint8_t sum = header[1] + header[2] + header[3];
+  for(uint16_t i = 0; i < length; i++) { sum += payload[i]; }
+  uint8_t checksum = -sum;
+  stream.write(header, 4);
+  stream.write(payload, length);
+  stream.write(&checksum, 1);
+}
+
+
+#ifdef ENABLE_COLOR_CORRECTION_TESTS
+// The main test loop with serial IO; never returns. Applications with their own loop should call BeginTests() and Tick() instead
+void GammaManager::RunTests(uint16_t thickness, uint16_t gradientLength) {
+  BeginTests(thickness, gradientLength);
+  while(true) { Tick(); }
+}
+
+// Starts the calibration patterns from the first one
+void GammaManager::BeginTests(uint16_t thickness, uint16_t gradientLength) {
+  testThickness = thickness;
+  testGradientLength = gradientLength;
+  testMode = 0;
+  serialLine = "";
+  pendingCommand = 0;
+  *globalBrightness = INITIAL_TEST_BRIGHTNESS;
+  for(uint16_t i = 0; i < numLEDs; i++) { leds[i] = CRGB::Black; }
+  for(uint16_t i = 0; i < numLEDs; i++) { leds_b[i] = 255; }
+  PrintTestMenu();
+}
 
-    for(uint16_t i = 0; i < numLEDs; i++) { leds[i] = CRGB::Black; }
-    curMode = (curMode+1) % 9;
+// Draws and shows one frame of the current test pattern, and handles whatever serial input has arrived. Never blocks
+void GammaManager::Tick() {
+  PollSerialInput();
+  DrawTestPattern();
+  PrepPixelsForFastLED();
+  FastLED.show();
+}
+
+void GammaManager::DrawTestPattern() {
+  uint16_t thickness = testThickness;
+  if(testMode == 0) {
+    // The most common test; A gradient of RGB at the start and a gradient of HSV at the end
+    DrawGradientTest(leds, leds_b, numLEDs, testGradientLength);
+  }
+  else if(testMode == 1) { 
+    // A single pattern of RGB
+    if(numLEDs > 6*(thickness+1)) { DrawSimpleTest(leds, leds_b, 3*(thickness+1), thickness); }
+  }
+  else if(testMode == 2) {
+    // A repeating pattern of RGB
+    DrawSimpleTest(leds, leds_b, numLEDs, thickness);
+  }
+  else if(testMode == 3) {
+    // A strip of white at each end
+    DrawWhiteTest(leds, leds_b, min(uint16_t(numLEDs), uint16_t(2*thickness)), 0); // todo: investigate this: this is a hack to get around a bug in the esp libraries
+    if(numLEDs > 4*thickness) {
+      DrawWhiteTest(&leds[numLEDs-2*thickness], &leds_b[numLEDs-2*thickness], 2*thickness, 0);
+    }
+  }
+  else if(testMode == 4) {
+    // White every third pixel
+    DrawWhiteTest(leds, leds_b, numLEDs, 2);
   }
+  else if(testMode == 5) {
+    // White every pixel
+    DrawWhiteTest(leds, leds_b, numLEDs, 0);
+  }
+  else if(testMode == 6) {
+    // One stripe of colors with middle colors drawn; brightness derived from gammaDim
+    DrawMidpointTest(leds, leds_b, numLEDs, thickness, true);
+  }
+  else if(testMode == 7) {
+    // Stripes of colors with middle colors drawn; brightness derived from gammaDim
+    DrawMidpointTest(leds, leds_b, numLEDs, thickness);
+  }
+  else if(testMode == 8) {
+    // One long stretch of white to see how overall dimming works
+    DrawDimmingTest(leds, leds_b, numLEDs, testGradientLength);
+  }
+}
+
+void GammaManager::NextTestPattern() {
+  for(uint16_t i = 0; i < numLEDs; i++) { leds[i] = CRGB::Black; }
+  testMode = (testMode+1) % 9;
 }
 
 // ------------ Tests ------------
 // Draws a gradient (or double gradient if room) of RGB from the front end, and HSV from the back end
-void GammaManager::RunGradientTest(CRGB* leds, uint8_t* leds_b, uint16_t numLEDs, uint16_t gradientLength) {
+void GammaManager::DrawGradientTest(CRGB* leds, uint8_t* leds_b, uint16_t numLEDs, uint16_t gradientLength) {
+  (void)leds_b; // Same signature as the other patterns, but gradients leave leds_b as it is
   while(numLEDs < 6*gradientLength) { gradientLength--; }
   bool doDouble = numLEDs > 12*gradientLength;
 
-  do {
-    fill_gradient(&leds[numLEDs-3*gradientLength], 3*gradientLength, CHSV(255,255,255), CHSV(0,255,255), LONGEST_HUES);
-    for(int i = numLEDs-3*gradientLength; i < numLEDs; i++) { Inverse(leds[i]); }
+  if(useLookupMatrices) {
+    FillGradientHSV(&leds[numLEDs-3*gradientLength], 3*gradientLength, CHSV(255,255,255), CHSV(0,255,255), LONGEST_HUES);
     if(doDouble) {
-      fill_gradient(&leds[numLEDs-6*gradientLength], 3*gradientLength, CHSV(255,255,255), CHSV(0,255,255), LONGEST_HUES);
-      for(int i = numLEDs-6*gradientLength; i < numLEDs-3*gradientLength; i++) { Inverse(leds[i]); }
+      FillGradientHSV(&leds[numLEDs-6*gradientLength], 3*gradientLength, CHSV(255,255,255), CHSV(0,255,255), LONGEST_HUES);
     }
-    
-    fill_gradient_RGB(leds,   0, CRGB(255,0,0),  gradientLength, CRGB(0,255,0));
-    fill_gradient_RGB(leds,  gradientLength, CRGB(0,255,0),2*gradientLength, CRGB(0,0,255));
-    fill_gradient_RGB(leds,2*gradientLength, CRGB(0,0,255),3*gradientLength, CRGB(255,0,0));
+  }
+  else {
+    fill_gradient(&leds[numLEDs-3*gradientLength], 3*gradientLength, CHSV(255,255,255), CHSV(0,255,255), LONGEST_HUES);
+    TestInverseRange(&leds[numLEDs-3*gradientLength], 3*gradientLength);
     if(doDouble) {
-      fill_gradient_RGB(leds,3*gradientLength, CRGB(255,0,0),4*gradientLength, CRGB(0,255,0));
-      fill_gradient_RGB(leds,4*gradientLength, CRGB(0,255,0),5*gradientLength, CRGB(0,0,255));
-      fill_gradient_RGB(leds,5*gradientLength, CRGB(0,0,255),6*gradientLength, CRGB(255,0,0));
+      fill_gradient(&leds[numLEDs-6*gradientLength], 3*gradientLength, CHSV(255,255,255), CHSV(0,255,255), LONGEST_HUES);
+      TestInverseRange(&leds[numLEDs-6*gradientLength], 3*gradientLength);
     }
-
-    PrepPixelsForFastLED();
-	  FastLED.show();
-  } while(ProcessSerialInput());
+  }
+  
+  fill_gradient_RGB(leds,   0, CRGB(255,0,0),  gradientLength, CRGB(0,255,0));
+  fill_gradient_RGB(leds,  gradientLength, CRGB(0,255,0),2*gradientLength, CRGB(0,0,255));
+  fill_gradient_RGB(leds,2*gradientLength, CRGB(0,0,255),3*gradientLength, CRGB(255,0,0));
+  if(doDouble) {
+    fill_gradient_RGB(leds,3*gradientLength, CRGB(255,0,0),4*gradientLength, CRGB(0,255,0));
+    fill_gradient_RGB(leds,4*gradientLength, CRGB(0,255,0),5*gradientLength, CRGB(0,0,255));
+    fill_gradient_RGB(leds,5*gradientLength, CRGB(0,0,255),6*gradientLength, CRGB(255,0,0));
+  }
 }
 
 // Shows bands of pure hues for color balancing
-void GammaManager::RunSimpleTest(CRGB* leds, uint8_t* leds_b, uint16_t numLEDs, uint8_t thickness) {
+void GammaManager::DrawSimpleTest(CRGB* leds, uint8_t* leds_b, uint16_t numLEDs, uint8_t thickness) {
   uint16_t period = 3*(thickness+1);
   while(numLEDs < period) { thickness--; }
   for(uint16_t i = 0; i < numLEDs; i++) { leds[i] = CRGB::Black; }
 
-  do {
-		for(int i=0; i+period <= numLEDs; i+=period) {
-      for(int j = 0; j < thickness; j++) {
-        leds[i+j] = CRGB(255,0,0);
-        leds[i+j+thickness+1] = CRGB(0,255,0);
-        leds[i+j+2*(thickness+1)] = CRGB(0,0,255);
-        
-        leds_b[i+j] = 255;
-        leds_b[i+j+thickness+1] = 255;
-        leds[i+j+2*(thickness+1)] = 255;
-      }
+  for(int i=0; i+period <= numLEDs; i+=period) {
+    for(int j = 0; j < thickness; j++) {
+      leds[i+j] = CRGB(255,0,0);
+      leds[i+j+thickness+1] = CRGB(0,255,0);
+      leds[i+j+2*(thickness+1)] = CRGB(0,0,255);
+      
+      leds_b[i+j] = 255;
+      leds_b[i+j+thickness+1] = 255;
+      leds[i+j+2*(thickness+1)] = 255;
     }
-
-    PrepPixelsForFastLED();
-	  FastLED.show();
-  } while(ProcessSerialInput());
+  }
 }
 
 // Shows bands of white LEDs for color balancing and red shift detection
-void GammaManager::RunWhiteTest(CRGB* leds, uint8_t* leds_b, uint16_t numLEDs, uint8_t spacing) {
+void GammaManager::DrawWhiteTest(CRGB* leds, uint8_t* leds_b, uint16_t numLEDs, uint8_t spacing) {
   uint8_t interval = spacing + 1;
-  
-  do {
-	  for(uint16_t i = 0; i < numLEDs; i+=interval) {
-      leds[i] = CRGB(255, 255, 255);
-      leds_b[i] = 255;
-	  }
-
-	  PrepPixelsForFastLED();
-	  FastLED.show();
-  } while(ProcessSerialInput());
+  for(uint16_t i = 0; i < numLEDs; i+=interval) {
+    leds[i] = CRGB(255, 255, 255);
+    leds_b[i] = 255;
+  }
 }
 
 // Shows bands of pure and midpoint colors for color balancing and gamma tuning
-void GammaManager::RunMidpointTest(CRGB* leds, uint8_t* leds_b, uint16_t numLEDs, uint8_t thickness, bool onePatternOnly) {
+void GammaManager::DrawMidpointTest(CRGB* leds, uint8_t* leds_b, uint16_t numLEDs, uint8_t thickness, bool onePatternOnly) {
   uint16_t period = 6*thickness;
   while(numLEDs < period) { thickness--; }
   
-  do {
-    for(int i=0; i+period < numLEDs; i+=period) {
-      for(int j = 0; j < thickness; j++) {
-        leds[i+j] = CRGB(255,0,0);
-        leds[i+j+2*thickness] = CRGB(0,255,0);
-        leds[i+j+4*thickness] = CRGB(0,0,255);
-        leds_b[i+j] = 255;
-        leds_b[i+j+2*thickness] = 255;
-        leds_b[i+j+4*thickness] = 255;
-        
-        leds[i+j+thickness] = CRGB(128,128,0);
-        leds[i+j+3*thickness] = CRGB(0,128,128);
-        leds[i+j+5*thickness] = CRGB(128,0,128);
-        leds_b[i+j+thickness] = 255;
-        leds_b[i+j+3*thickness] = 255;
-        leds_b[i+j+5*thickness] = 255;
-      }
-      if(onePatternOnly) { break; }
+  for(int i=0; i+period < numLEDs; i+=period) {
+    for(int j = 0; j < thickness; j++) {
+      leds[i+j] = CRGB(255,0,0);
+      leds[i+j+2*thickness] = CRGB(0,255,0);
+      leds[i+j+4*thickness] = CRGB(0,0,255);
+      leds_b[i+j] = 255;
+      leds_b[i+j+2*thickness] = 255;
+      leds_b[i+j+4*thickness] = 255;
+      
+      leds[i+j+thickness] = CRGB(128,128,0);
+      leds[i+j+3*thickness] = CRGB(0,128,128);
+      leds[i+j+5*thickness] = CRGB(128,0,128);
+      leds_b[i+j+thickness] = 255;
+      leds_b[i+j+3*thickness] = 255;
+      leds_b[i+j+5*thickness] = 255;
     }
-    
-    PrepPixelsForFastLED();
-	  FastLED.show();
-  } while(ProcessSerialInput());
+    if(onePatternOnly) { break; }
+  }
 }
 
 // Draws dimmed gradients: white, yellow, fusia
-void GammaManager::RunDimmingTest(CRGB* leds, uint8_t* leds_b, uint16_t numLEDs, uint16_t gradientLength) {
+void GammaManager::DrawDimmingTest(CRGB* leds, uint8_t* leds_b, uint16_t numLEDs, uint16_t gradientLength) {
 	uint8_t length = 2*gradientLength;
 	if(numLEDs < length) { length = numLEDs; }
 	float fadeStepSize = 255.0 / length;
 	
-	do {
-		for(uint16_t i = 0; i < length; i++) {
-			leds[i] = CRGB(255,255,255);
-			leds_b[i] = (i+1)*fadeStepSize;
-			
-			if(numLEDs >= 2*length+5) {
-				leds[i+length+5] = CRGB(255,255,0);
-				leds_b[i+length+5] = (i+1)*fadeStepSize;
-			}
-			
-			if(numLEDs >= 3*length+10) {
-				//leds[i+2*length+10].r = colCorrection >> 8;
-				//leds[i+2*length+10].b = leds[i+2*length+10].r >> 3;
-				leds[i+2*length+10] = CRGB(255,0,255);
-        leds_b[i+2*length+10] = (i+1)*fadeStepSize;
-			}
+	for(uint16_t i = 0; i < length; i++) {
+		leds[i] = CRGB(255,255,255);
+		leds_b[i] = (i+1)*fadeStepSize;
+		
+		if(numLEDs >= 2*length+5) {
+			leds[i+length+5] = CRGB(255,255,0);
+			leds_b[i+length+5] = (i+1)*fadeStepSize;
 		}
 		
-		PrepPixelsForFastLED();
-	  FastLED.show();
-  } while(ProcessSerialInput());
+		if(numLEDs >= 3*length+10) {
+			//leds[i+2*length+10].r = colCorrection >> 8;
+			//leds[i+2*length+10].b = leds[i+2*length+10].r >> 3;
+			leds[i+2*length+10] = CRGB(255,0,255);
+      leds_b[i+2*length+10] = (i+1)*fadeStepSize;
+		}
+	}
 }
 
-// Handles serial IO while running RunTests()
-bool GammaManager::ProcessSerialInput() {
+float GammaManager::fGammaR = 1.40;//1.30;//1.9;//1.60;//1.75;//1.8;//1.65;//1.15;
+float GammaManager::fGammaG = 1.35;//1.75;//1.9;//1.75;//1.90;//1.6;//2.1;//1.65;
+float GammaManager::fGammaB = 1.5;//2.00;//1.8;//1.80;//2.00;//3.1;//3.1;//2.85;
+uint8_t GammaManager::tuneGammaR[256];
+uint8_t GammaManager::tuneGammaG[256];
+uint8_t GammaManager::tuneGammaB[256];
+uint8_t GammaManager::tuneReverseGammaR[256];
+uint8_t GammaManager::tuneReverseGammaG[256];
+uint8_t GammaManager::tuneReverseGammaB[256];
+
+// Regenerates the tuning matrices after fGammaR/G/B change, with the same math as WriteGammaMatrices()
+void GammaManager::RebuildTuningMatrices() {
+  BuildGammaTable(tuneGammaR, fGammaR);
+  BuildGammaTable(tuneGammaG, fGammaG);
+  BuildGammaTable(tuneGammaB, fGammaB);
+  BuildReverseGammaTable(tuneReverseGammaR, tuneGammaR);
+  BuildReverseGammaTable(tuneReverseGammaG, tuneGammaG);
+  BuildReverseGammaTable(tuneReverseGammaB, tuneGammaB);
+}
+
+// InverseRange() for test patterns, using the tuning matrices unless the project's matrices are in use
+void GammaManager::TestInverseRange(CRGB* pixels, uint16_t count) {
+  if(useLookupMatrices) {
+    InverseRange(pixels, count);
+    return;
+  }
+
+  for(uint16_t i = 0; i < count; i++) {
+    pixels[i].r = tuneReverseGammaR[pixels[i].r];
+    pixels[i].g = tuneReverseGammaG[pixels[i].g];
+    pixels[i].b = tuneReverseGammaB[pixels[i].b];
+  }
+}
+
+void GammaManager::PrintTestMenu() {
   Serial.println("\nTo edit Gamma, enter: r,g,b, or a(all). 'w' to write matrices. 'u' to toggle matrix use");
   Serial.println("'###' sets brightness (1-255). 'n' for next pattern. 'c' for colorCorrection");
   Serial.println("brightness +/- with '-', '='. Shift for *2");
+  #ifdef ENABLE_GAMMA_STATS
+    Serial.println("'s' to print Prep stats, 'x' to reset them");
+  #endif
   uint32_t colCorrectInt = (colorCorrections[0].r<<16) + (colorCorrections[0].g<<8)+ (colorCorrections[0].b);
   Serial.println("Brightness: " + String(*globalBrightness) + ", Color Correction: 0x" + String(colCorrectInt, HEX));
   if(useLookupMatrices) { Serial.println("------------- Using matrices defined in your project -------------"); }
   else { Serial.println("Gammas: R:" + String(fGammaR) + "\tG:" + String(fGammaG) + "\tB:" + String(fGammaB)); }
-  
-  while(Serial.available() == 0) ;
-  String s = Serial.readString();
+}
+
+// Collects whatever serial input is available without waiting. A line ends at a newline, or once input goes idle
+void GammaManager::PollSerialInput() {
+  while(Serial.available() > 0) {
+    // A sync byte at the start of a line switches to the binary protocol until its packets are complete
+    if(binaryState != BINARY_SYNC || (serialLine.length() == 0 && Serial.peek() == GAMMA_BINARY_SYNC)) {
+      ProcessBinaryInput(Serial);
+      continue;
+    }
+    char c = Serial.read();
+    lastSerialInput = millis();
+    if(c == '\n' || c == '\r') {
+      if(serialLine.length() > 0) { HandleSerialLine(); }
+    }
+    else {
+      serialLine += c;
+    }
+  }
+
+  if(serialLine.length() > 0 && millis() - lastSerialInput >= SERIAL_LINE_TIMEOUT) { HandleSerialLine(); }
+}
+
+// Handles one line of serial input while running the tests
+void GammaManager::HandleSerialLine() {
+  String s = serialLine;
+  serialLine = "";
   s.trim();
+
+  if(pendingCommand != 0) {
+    // This line is the value the previous command prompted for
+    char command = pendingCommand;
+    pendingCommand = 0;
+    HandleSerialValue(command, s);
+    PrintTestMenu();
+    return;
+  }
   
   if(s == "-") {
 	  *globalBrightness = *globalBrightness - 1;
@@ -291,40 +1596,38 @@ bool GammaManager::ProcessSerialInput() {
 	*globalBrightness = *globalBrightness + 2;
   }
   else if(s == "n") {
-    return false;
+    NextTestPattern();
+  }
+  #ifdef ENABLE_GAMMA_STATS
+  else if(s == "s") {
+    PrintStats(Serial);
+  }
+  else if(s == "x") {
+    ResetStats();
   }
+  #endif
   else if(s == "u") {
     useLookupMatrices = !useLookupMatrices;
   }
   else if(s == "a") {
     Serial.println("Enter new gamma value.");
-    while(Serial.available() == 0) ;
-    s = Serial.readString();
-    s.trim();
-    fGammaR = s.toFloat();
-    fGammaG = fGammaR;
-    fGammaB = fGammaR;
+    pendingCommand = 'a';
+    return;
   }
   else if(s == "r") {
     Serial.println("Enter new red gamma value. (Current is " + String(fGammaR) + ")");
-    while(Serial.available() == 0) ;
-    s = Serial.readString();
-    s.trim();
-    fGammaR = s.toFloat();
+    pendingCommand = 'r';
+    return;
   }
   else if(s == "g") {
     Serial.println("Enter new green gamma value. (Current is " + String(fGammaG) + ")");
-    while(Serial.available() == 0) ;
-    s = Serial.readString();
-    s.trim();
-    fGammaG = s.toFloat();    
+    pendingCommand = 'g';
+    return;
   }
   else if(s == "b") {
     Serial.println("Enter new blue gamma value. (Current is " + String(fGammaB) + ")");
-    while(Serial.available() == 0) ;
-    s = Serial.readString();
-    s.trim();
-    fGammaB = s.toFloat();
+    pendingCommand = 'b';
+    return;
   }
   else if(s == "w") {
     Serial.println("\n");
@@ -335,9 +1638,37 @@ bool GammaManager::ProcessSerialInput() {
   }
   else if(s == "c") {
     Serial.println("Enter new color correction as a 6-digit hex number");
-    while(Serial.available() == 0) ;
-    s = Serial.readString();
-    s.trim();
+    pendingCommand = 'c';
+    return;
+  }
+  else {
+    *globalBrightness = s.toInt();
+  }
+
+  PrintTestMenu();
+}
+
+// Applies the value entered after a prompting command
+void GammaManager::HandleSerialValue(char command, String s) {
+  if(command == 'a') {
+    fGammaR = s.toFloat();
+    fGammaG = fGammaR;
+    fGammaB = fGammaR;
+    RebuildTuningMatrices();
+  }
+  else if(command == 'r') {
+    fGammaR = s.toFloat();
+    RebuildTuningMatrices();
+  }
+  else if(command == 'g') {
+    fGammaG = s.toFloat();
+    RebuildTuningMatrices();
+  }
+  else if(command == 'b') {
+    fGammaB = s.toFloat();
+    RebuildTuningMatrices();
+  }
+  else if(command == 'c') {
     s.toUpperCase();
 
     uint32_t colCorrection = 0;
@@ -354,60 +1685,14 @@ bool GammaManager::ProcessSerialInput() {
 
     SetAllColorCorrections(colCorrection);
   }
-  else {
-    *globalBrightness = s.toInt();
-  }
-
-  return true;
 }
 
 // Uses current gamma and dimming values to output matrices, which should be pasted into the main project
 void GammaManager::WriteGammaMatrices(float gamma, int max_in, int max_out, String matrixNameSuffix, bool includeReverse) {
-  int forwardGamma[256];
-  int reverseGamma[256];
-  for(int i=0; i <= 255; i++) {
-    forwardGamma[i] = i >= max_in ? max_out : (int)(pow((float)i / (float)max_in, gamma) * max_out + 0.5);
-    if(i > 0 && forwardGamma[i] == 0) { forwardGamma[i] = 1; }
-  }
-
-  // Write reverse gamma matrix
-  int iForward = 0;
-  int iScaledLast = -1;
-  for(int i = 0; i <= 255; i++) {
-    // Scale before lookup
-    int iScaled = i * max_out / 255;
-    if(iScaled == 0 && i > 0) { iScaled = 1; }
-    if(iScaledLast == iScaled) {
-      reverseGamma[i] = reverseGamma[i-1];
-      continue;
-    }
-    iScaledLast = iScaled;
-    
-    if(iForward >= 255) {
-      reverseGamma[i] = 255;
-    }
-    else if(forwardGamma[iForward] == forwardGamma[iForward+1]) {
-      int iForwardInit = iForward;
-      while(forwardGamma[iForward] == forwardGamma[iForwardInit]) { iForward++; }
-      iForward--;
-      // indexes now span the range of gammas that match this index
-      reverseGamma[i] = (iForward + iForwardInit) / 2;
-      iForward++;
-    }
-    else if(forwardGamma[iForward] == iScaled) {
-      reverseGamma[i] = iForward;
-      iForward++;
-    }
-    else {
-      // Skipped a value in the gamma matrix; determine which one is closer to i
-      if(iScaled - forwardGamma[iForward - 1] <= forwardGamma[iForward] - iScaled) {
-        reverseGamma[i] = iForward - 1;
-      }
-      else {
-        reverseGamma[i] = iForward;
-      }
-    }
-  }
+  uint8_t forwardGamma[256];
+  uint8_t reverseGamma[256];
+  BuildGammaTable(forwardGamma, gamma, max_in, max_out);
+  BuildReverseGammaTable(reverseGamma, forwardGamma, max_out);
   
   // Write forward gamma matrix to serial
   Serial.print("const uint8_t PROGMEM gamma" + matrixNameSuffix + "[] = {");
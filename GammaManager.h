@@ -1,19 +1,168 @@
 #pragma once
 #include "Arduino.h"
 #include "FastLED.h"
+#include "GammaTables.h"
 
-#define ENABLE_COLOR_CORRECTION_TESTS
+// Calibration patterns and serial tuning (RunTests()); build with DISABLE_COLOR_CORRECTION_TESTS defined to leave them out
+#ifndef DISABLE_COLOR_CORRECTION_TESTS
+  #define ENABLE_COLOR_CORRECTION_TESTS
+#endif
+//#define ENABLE_GAMMA_STATS // Times each Prep call, APA102 variants included, and collects pixel statistics; compiles out entirely when not defined
+
+// Dual-core ESP32 builds can split PrepPixelsForFastLED() across both cores
+#if defined(ESP32) && !defined(CONFIG_FREERTOS_UNICORE)
+  #define GAMMA_PARALLEL_PREP
+  #include "freertos/FreeRTOS.h"
+  #include "freertos/task.h"
+  #include "freertos/semphr.h"
+#endif
+
+// 16-bit per channel pixel for the optional linear working buffer; 0xFF00 is full scale of an 8-bit channel
+struct CRGB16 {
+  uint16_t r;
+  uint16_t g;
+  uint16_t b;
+};
+
+// Color and leds_b brightness of one pixel packed into a single word, for the optional packed source buffer
+struct GammaPixel {
+  union {
+    struct {
+      uint8_t r;
+      uint8_t g;
+      uint8_t b;
+      uint8_t brightness;
+    };
+    uint32_t raw;
+  };
+};
+
+#ifdef ENABLE_GAMMA_STATS
+  // Prep timing is in CPU cycles, or in microseconds where there's no cycle counter
+  #if defined(ESP32) || defined(ESP8266)
+    #define GAMMA_STATS_TICKS() ESP.getCycleCount()
+  #else
+    #define GAMMA_STATS_TICKS() micros()
+  #endif
+
+  struct GammaStats {
+    uint32_t prepCount;
+    uint32_t minTicks;
+    uint32_t maxTicks;
+    uint64_t totalTicks;
+    uint32_t ticksHistogram[32];      // Prep calls by highest set bit of their duration
+    uint32_t litPixels;
+    uint32_t blackPixels;
+    uint32_t clampedPixels;           // Lit pixels whose scaled brightness was raised to 1
+    uint32_t brightnessHistogram[32]; // Lit pixels by 5-bit brightness
+  };
+#endif
+
+// A set of gamma and dimming matrices, which may be in PROGMEM. Any number of GammaManagers can share one profile
+struct GammaProfile {
+  const uint8_t* gammaR;
+  const uint8_t* gammaG;
+  const uint8_t* gammaB;
+  const uint8_t* reverseGammaR;
+  const uint8_t* reverseGammaG;
+  const uint8_t* reverseGammaB;
+  const uint8_t* gammaDim_5bit;
+  const uint8_t* gammaDim;
+};
+
+// Built from the matrices in GammaManagerConfig.h
+extern const GammaProfile defaultGammaProfile;
+#ifdef GAMMA_TABLES_CONSTEXPR
+  extern const GammaInterleavedTables defaultInterleavedTables;
+#endif
+
+// Copies profile's matrices into the interleaved layout, e.g. into a table placed in fast RAM
+void BuildInterleavedTables(GammaInterleavedTables* tables, const GammaProfile* profile);
+
+// Binary serial protocol handled by ProcessBinaryInput(). Every packet, in both directions, is
+//   0xA5, command, length (2 bytes, little endian), payload[length], checksum
+// where checksum makes the 8-bit sum of command, length and payload bytes zero. Each command is answered with
+// command|0x80 and a payload of one GammaBinaryStatus byte, except STATS which answers with the GammaStats struct.
+// FRAME and TABLE bytes land in place as they arrive, so a bad checksum is reported but not undone
+#define GAMMA_BINARY_SYNC 0xA5
+enum GammaBinaryCommand {
+  GAMMA_CMD_FRAME = 0x01,      // start index (2 bytes), then r,g,b,leds_b per pixel into leds[] or the packed buffer; not with linear or indexed buffers
+  GAMMA_CMD_SHOW = 0x02,       // PrepPixelsForFastLED() and FastLED.show()
+  GAMMA_CMD_TABLE = 0x03,      // table index (0-7, in GammaProfile order), then 256 bytes
+  GAMMA_CMD_STATS = 0x04,      // no payload
+  GAMMA_CMD_BRIGHTNESS = 0x05  // new globalBrightness (1 byte)
+};
+enum GammaBinaryStatus {
+  GAMMA_STATUS_OK = 0,
+  GAMMA_STATUS_BAD_CHECKSUM = 1,
+  GAMMA_STATUS_BAD_PACKET = 2
+};
+
+// Receives each chunk of SPI data from PrepAPA102Pipelined(); called with (NULL, 0) once the frame is complete.
+// A sink may queue the chunk for DMA and return, but must first wait for the chunk it was previously given to finish sending
+typedef void (*APA102ChunkSink)(const uint8_t* data, uint16_t length, void* context);
+#define APA102_MAX_CHUNK_PIXELS 16383
+
+// Separate spans MarkDirty() keeps between Prep calls; past this many, the two closest merge. See GetDirtySpan()
+#define GAMMA_MAX_DIRTY_SPANS 8
 
 class GammaManager {
   public:
-    void Init(CRGB* _leds, uint8_t* _leds_b, uint8_t* _leds_5bit_brightness, uint16_t _numLEDs, uint8_t *_globalBrightness);
+    void Init(CRGB* _leds, uint8_t* _leds_b, uint8_t* _leds_5bit_brightness, uint16_t _numLEDs, uint8_t *_globalBrightness, const GammaProfile* _profile = &defaultGammaProfile);
+    void SetProfile(const GammaProfile* _profile);
+    void SetInterleavedTables(const GammaInterleavedTables* tables);
+    void SetAllColorCorrections(uint32_t colCorrect);
+    void SetColorCorrection(uint8_t brightness5bit, CRGB correction);
     void Correct(CRGB& pixel);
     void Inverse(CRGB& pixel);
+    void CorrectRange(CRGB* pixels, uint16_t count);
+    void InverseRange(CRGB* pixels, uint16_t count);
 	  CRGB Blend(CRGB& a, CRGB& b, fract8 blendAmount);
 	  void BlendInPlace(CRGB& a, CRGB& b, fract8 blendAmount);
+    void BlendRange(CRGB* a, const CRGB* b, uint16_t count, fract8 blendAmount);
+    void BlendRange(CRGB* a, const CRGB* b, uint16_t count, const fract8* blendAmounts);
+    void BlendRange(CRGB* a, const CRGB& b, uint16_t count, fract8 blendAmount);
+    void BlendRange(CRGB* a, const CRGB& b, uint16_t count, const fract8* blendAmounts);
+    void FillGradientRGB(CRGB* pixels, uint16_t count, const CRGB& start, const CRGB& end);
+    void FillGradientRGB(CRGB* pixels, uint16_t count, const CRGB* stops, uint8_t numStops);
+    void FillGradientHSV(CRGB* pixels, uint16_t count, const CHSV& start, const CHSV& end, TGradientDirectionCode directionCode = SHORTEST_HUES);
+    void FillGradientHSV(CRGB* pixels, uint16_t count, const CHSV* stops, uint8_t numStops, TGradientDirectionCode directionCode = SHORTEST_HUES);
+    void CrossfadeFrames(const CRGB* fromLeds, const uint8_t* from_b, const CRGB* toLeds, const uint8_t* to_b, fract8 amount, CRGB* outLeds = NULL, uint8_t* out_b = NULL);
     void PrepPixelsForFastLED();
+    void EnableDirtyTracking(bool enable);
+    void MarkDirty(uint16_t start, uint16_t count);
+    void MarkAllDirty();
+    bool GetDirtySpan(uint8_t index, uint16_t& start, uint16_t& end);
+    bool NeedsFullRedraw();
+    void SetLinearBuffer(CRGB16* _linearLeds);
+    void SetPackedBuffer(GammaPixel* _packedLeds);
+    void SetIndexedBuffer(uint8_t* _indexedLeds, const GammaPixel* _palette, GammaPixel* _preparedPalette, uint16_t _paletteSize);
+    CRGB16 Linearize(const CRGB& corrected);
+    void BlendLinear(CRGB16& a, const CRGB16& b, fract16 blendAmount);
+    void SetOutputBuffers(CRGB* out0, uint8_t* out0_5bit_brightness, CRGB* out1 = NULL, uint8_t* out1_5bit_brightness = NULL);
+    CRGB* GetOutputLeds();
+    uint8_t* GetOutput5bitBrightness();
+    void EnableParallelPrep(bool enable);
+    void RampBrightness(uint8_t target, uint32_t durationMs);
+    bool IsRamping();
+    void EnablePowerEstimate(bool enable);
+    void SetPowerModel(uint8_t redMilliamps, uint8_t greenMilliamps, uint8_t blueMilliamps, uint8_t idleMilliamps);
+    void SetPowerLimit(uint32_t _maxMilliamps);
+    uint32_t GetEstimatedMilliamps();
+    void ProcessBinaryInput(Stream& stream);
+    void SetTableUploadBuffer(uint8_t* storage);
+    #ifdef ENABLE_GAMMA_STATS
+      const GammaStats& GetStats();
+      void ResetStats();
+      void PrintStats(Print& out);
+    #endif
+    uint32_t APA102FrameSize();
+    uint32_t PrepAPA102Frame(uint8_t* frame, EOrder order = BGR);
+    void PrepAPA102Pipelined(uint8_t* buffer0, uint8_t* buffer1, uint16_t chunkPixels, APA102ChunkSink sink, void* context = NULL, EOrder order = BGR);
     #ifdef  ENABLE_COLOR_CORRECTION_TESTS
       void RunTests(uint16_t thickness = 4, uint16_t gradientLength = 32);
+      void BeginTests(uint16_t thickness = 4, uint16_t gradientLength = 32);
+      void Tick();
     #endif
   private:
     CRGB* leds;
@@ -21,20 +170,164 @@ class GammaManager {
     uint8_t* leds_5bit_brightness;
     uint16_t numLEDs;
     uint8_t* globalBrightness;
+    CRGB16* linearLeds = NULL;
+    GammaPixel* packedLeds = NULL;
+    uint8_t* indexedLeds = NULL;
+    const GammaPixel* palette = NULL;
+    GammaPixel* preparedPalette = NULL;
+    uint16_t paletteSize = 0;
+
+    // Matrices are shared between instances; color corrections, indexed by 5-bit brightness, belong to this strip
+    const GammaProfile* profile;
+    const GammaInterleavedTables* interleavedTables = NULL;
+    CRGB colorCorrections[32];
+
+    // Optional output buffers, so Prep leaves leds[] untouched; Prep writes the back buffer, then it becomes the front
+    CRGB* outputLeds[2] = { NULL, NULL };
+    uint8_t* output5bit[2] = { NULL, NULL };
+    uint8_t frontBuffer = 0;
+    uint8_t backBuffer = 0;
+
+    // Per-leds_b values used by PrepPixelsForFastLED(); reset when globalBrightness, colorCorrections or profile change,
+    // then filled per leds_b value as Prep needs them. prepEntryReady holds one bit per leds_b value
+    uint8_t prep5bit[256];
+    CRGB prepCorrections[256];
+    uint8_t prepEntryReady[32];
+    bool prepCacheValid = false;
+    uint8_t prepCacheBrightness = 0;
+    void PrepFrame();
+    bool PrepCacheStale();
+    void RebuildPrepCache();
+    void FillPrepEntry(uint8_t level);
+    void RequirePrepEntry(uint8_t level);
+    void FillPrepCache();
+    void UpdatePrepCache();
+    uint8_t* EncodeAPA102(uint8_t* frame, uint16_t first, uint16_t last, EOrder order);
+    void PrepSourceRange(CRGB* out, uint8_t* out5bit, uint16_t first, uint16_t last, uint32_t* power);
+    struct CRGBSource;
+    struct LinearSource;
+    struct PackedSource;
+    struct IndexedSource;
+    template<typename Source> void PrepRangeFrom(const Source& source, CRGB* out, uint8_t* out5bit, uint16_t first, uint16_t last, uint32_t* power);
+    void PreparePalette();
+    void ApplyOutputGamma(CRGB& pixel);
+    void ApplyOutputGamma16(uint16_t r, uint16_t g, uint16_t b, CRGB& out);
+    void ReadDim(uint8_t level, uint8_t& brightness5bit, uint8_t& dimAmount);
+    uint16_t DimLight(uint8_t level);
+    uint8_t DimLevelForLight(uint16_t light);
+
+    // Sorted, disjoint [start, end) spans; one slot past the limit holds a new span until the closest two are merged
+    struct DirtySpans {
+      uint8_t count = 0;
+      uint16_t starts[GAMMA_MAX_DIRTY_SPANS + 1];
+      uint16_t ends[GAMMA_MAX_DIRTY_SPANS + 1];
+      void Add(uint16_t start, uint16_t end);
+    };
+
+    // Spans of leds[] (or linearLeds[]/packedLeds[]/indexedLeds[]) written since the last PrepPixelsForFastLED(), when dirty tracking is enabled
+    bool trackDirty = false;
+    DirtySpans dirty;
+    DirtySpans prevDirty;
+    uint8_t fullPrepsPending = 0;
+    bool PrepsInPlace();
+    void PrepSpan(CRGB* out, uint8_t* out5bit, uint16_t first, uint16_t last, uint32_t* power);
+
+    // Brightness ramp started by RampBrightness(), advanced at the start of each Prep
+    bool rampActive = false;
+    uint8_t rampFrom = 0;
+    uint8_t rampTarget = 0;
+    uint8_t rampCurrent = 0;
+    uint32_t rampStartMs = 0;
+    uint32_t rampDurationMs = 0;
+    void AdvanceBrightnessRamp();
+
+    // Power estimate accumulated by Prep: per-channel sums of output value times 5-bit brightness, converted with powerModel
+    // (R, G, B and idle milliamps). With a limit, Prep runs at the lower of *globalBrightness and powerLimitBrightness
+    bool measurePower = false;
+    uint8_t powerModel[4] = { 16, 11, 15, 1 };
+    uint32_t powerSums[3];
+    uint32_t maxMilliamps = 0;
+    uint32_t estimatedMilliamps = 0;
+    uint8_t powerLimitBrightness = 255;
+    uint8_t FrameBrightness();
+    void BeginPowerEstimate();
+    void EndPowerEstimate();
+
+#ifdef ENABLE_GAMMA_STATS
+    // Pixels processed at each leds_b level during the current Prep call
+    GammaStats stats;
+    uint32_t statsLevels[256];
+    void RecordPrepStats(uint32_t ticks);
+#endif
+
+    // Binary protocol parser state; payload bytes are stored as they arrive, so nothing is buffered
+    enum { BINARY_SYNC, BINARY_COMMAND, BINARY_LENGTH_LO, BINARY_LENGTH_HI, BINARY_PAYLOAD, BINARY_CHECKSUM };
+    uint8_t binaryState = BINARY_SYNC;
+    uint8_t binaryCommand;
+    uint16_t binaryLength;
+    uint16_t binaryPos;
+    uint8_t binarySum;
+    uint16_t binaryStart;
+    uint8_t binaryTable; // also holds the BRIGHTNESS value until the checksum passes
+    uint8_t* uploadedTables = NULL; // 8 tables of 256 bytes, in GammaProfile order
+    GammaProfile uploadedProfile;
+    void HandleBinaryPayloadByte(uint8_t c);
+    void HandleBinaryPacket(Stream& stream);
+    void SendBinaryReply(Stream& stream, uint8_t command, const uint8_t* payload, uint16_t length);
+
+#ifdef GAMMA_PARALLEL_PREP
+    // Worker task on the other core; Prep hands it the upper half of the range and waits for it to finish
+    static const uint16_t PARALLEL_PREP_MIN_PIXELS = 256;
+    bool parallelPrep = false;
+    TaskHandle_t prepWorker = NULL;
+    SemaphoreHandle_t prepWorkerStart = NULL;
+    SemaphoreHandle_t prepWorkerDone = NULL;
+    CRGB* workerOut;
+    uint8_t* workerOut5bit;
+    uint16_t workerFirst;
+    uint16_t workerLast;
+    bool workerMeasuresPower;
+    uint32_t workerPower[3];
+    static void PrepWorkerTask(void* param);
+#endif
 
 #ifdef ENABLE_COLOR_CORRECTION_TESTS
 	  uint8_t INITIAL_TEST_BRIGHTNESS = 64;
     bool useLookupMatrices = false;
-    float fGammaR = 1.40;//1.30;//1.9;//1.60;//1.75;//1.8;//1.65;//1.15;
-    float fGammaG = 1.35;//1.75;//1.9;//1.75;//1.90;//1.6;//2.1;//1.65;
-    float fGammaB = 1.5;//2.00;//1.8;//1.80;//2.00;//3.1;//3.1;//2.85;
+    // Gammas being tuned and the RAM matrices built from them, used while useLookupMatrices is false.
+    // Shared by all instances, since one set of gammas is tuned at a time
+    static float fGammaR;
+    static float fGammaG;
+    static float fGammaB;
+    static uint8_t tuneGammaR[256];
+    static uint8_t tuneGammaG[256];
+    static uint8_t tuneGammaB[256];
+    static uint8_t tuneReverseGammaR[256];
+    static uint8_t tuneReverseGammaG[256];
+    static uint8_t tuneReverseGammaB[256];
+    void RebuildTuningMatrices();
+    void TestInverseRange(CRGB* pixels, uint16_t count);
   
-    void RunGradientTest(CRGB* leds, uint8_t* leds_b, uint16_t numLEDs, uint16_t gradientLength = 32);
-    void RunSimpleTest(CRGB* leds, uint8_t* leds_b, uint16_t numLEDs, uint8_t thickness = 4);
-    void RunWhiteTest(CRGB* leds, uint8_t* leds_b, uint16_t numLEDs, uint8_t spacing);
-    void RunMidpointTest(CRGB* leds, uint8_t* leds_b, uint16_t numLEDs, uint8_t thickness = 4, bool onePatternOnly = false);
-	  void RunDimmingTest(CRGB* leds, uint8_t* leds_b, uint16_t numLEDs, uint16_t gradientLength);
+    // Test pattern and serial input state, advanced by Tick()
+    uint8_t testMode = 0;
+    uint16_t testThickness = 4;
+    uint16_t testGradientLength = 32;
+    static const uint16_t SERIAL_LINE_TIMEOUT = 100; // ms of idle input that ends a line sent without a newline
+    String serialLine;
+    uint32_t lastSerialInput = 0;
+    char pendingCommand = 0;
+
+    void DrawTestPattern();
+    void NextTestPattern();
+    void DrawGradientTest(CRGB* leds, uint8_t* leds_b, uint16_t numLEDs, uint16_t gradientLength = 32);
+    void DrawSimpleTest(CRGB* leds, uint8_t* leds_b, uint16_t numLEDs, uint8_t thickness = 4);
+    void DrawWhiteTest(CRGB* leds, uint8_t* leds_b, uint16_t numLEDs, uint8_t spacing);
+    void DrawMidpointTest(CRGB* leds, uint8_t* leds_b, uint16_t numLEDs, uint8_t thickness = 4, bool onePatternOnly = false);
+	  void DrawDimmingTest(CRGB* leds, uint8_t* leds_b, uint16_t numLEDs, uint16_t gradientLength);
     void WriteGammaMatrices(float gamma, int max_in = 255, int max_out = 255, String matrixNameSuffix = "", bool includeReverse = true);
-    bool ProcessSerialInput();
+    void PrintTestMenu();
+    void PollSerialInput();
+    void HandleSerialLine();
+    void HandleSerialValue(char command, String s);
 #endif
 };
@@ -1,7 +1,25 @@
 #include "FastLED.h"
+#include "GammaTables.h"
 
 //////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////// Gamma correction matrices //////////////////////////
+#ifdef GAMMA_TABLES_CONSTEXPR
+// Generated at compile time with the same rules as WriteGammaMatrices()
+constexpr GammaTable PROGMEM gammaRTable = MakeGammaTable(1.40);
+constexpr GammaTable PROGMEM reverseGammaRTable = MakeReverseGammaTable(1.40);
+constexpr GammaTable PROGMEM gammaGTable = MakeGammaTable(1.35);
+constexpr GammaTable PROGMEM reverseGammaGTable = MakeReverseGammaTable(1.35);
+constexpr GammaTable PROGMEM gammaBTable = MakeGammaTable(1.5);
+constexpr GammaTable PROGMEM reverseGammaBTable = MakeReverseGammaTable(1.5);
+
+constexpr const uint8_t (&gammaR)[256] = gammaRTable.values;
+constexpr const uint8_t (&reverseGammaR)[256] = reverseGammaRTable.values;
+constexpr const uint8_t (&gammaG)[256] = gammaGTable.values;
+constexpr const uint8_t (&reverseGammaG)[256] = reverseGammaGTable.values;
+constexpr const uint8_t (&gammaB)[256] = gammaBTable.values;
+constexpr const uint8_t (&reverseGammaB)[256] = reverseGammaBTable.values;
+#else
+// Pre-C++14 toolchains can't generate tables at compile time; these are WriteGammaMatrices() output for the same gammas
 const uint8_t PROGMEM gammaR[] = { // 1.4
   0,1,1,1,1,1,1,2,2,2,3,3,4,4,4,5,
   5,6,6,7,7,8,8,9,9,10,10,11,12,12,13,13,
@@ -109,6 +127,7 @@ const uint8_t PROGMEM reverseGammaB[] = {
   222,223,224,225,225,226,227,227,228,229,230,230,231,232,232,233,
   234,234,235,236,237,237,238,239,239,240,241,241,242,243,243,244,
   245,245,246,247,247,248,249,249,250,251,251,252,253,253,254,255 };
+#endif
 
 const uint8_t PROGMEM gammaDim_5bit[] = {
    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
@@ -181,7 +200,19 @@ const uint8_t PROGMEM gammaDim[] = {
   };
 
 
-CRGB colorCorrections[] = {
+const GammaProfile defaultGammaProfile = {
+  gammaR, gammaG, gammaB,
+  reverseGammaR, reverseGammaG, reverseGammaB,
+  gammaDim_5bit, gammaDim
+};
+
+#ifdef GAMMA_TABLES_CONSTEXPR
+// defaultGammaProfile's matrices in the interleaved layout, built at compile time; see SetInterleavedTables()
+constexpr GammaInterleavedTables PROGMEM defaultInterleavedTables = MakeInterleavedTables(gammaR, gammaG, gammaB, gammaDim_5bit, gammaDim);
+#endif
+
+// Initial color corrections of each GammaManager, indexed by 5-bit brightness
+const CRGB defaultColorCorrections[] = {
   #ifdef TEST_COLOR_CORRECTION
     0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF,
     0xFFFFFF, 0xFFFFFF, 0xFFFFFF, 0xFFFFFF,
@@ -221,11 +252,6 @@ CRGB colorCorrections[] = {
   #endif
 };
 
-void SetAllColorCorrections(uint32_t colCorrect) {
-    CRGB temp = CRGB(colCorrect);
-    for(uint8_t i = 0; i < 32; i++) { colorCorrections[i] = temp; }
-}
-
 /*
 const uint8_t PROGMEM gammaDim_5bit[] = {
    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
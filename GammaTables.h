@@ -0,0 +1,135 @@
+#pragma once
+#include <stdint.h>
+
+// Gamma matrix generation shared by GammaManagerConfig.h (at compile time) and WriteGammaMatrices() (at runtime).
+// With C++14 the builders are constexpr, so tables defined with them cost nothing at runtime and can live in flash.
+#if __cplusplus >= 201402L
+  #define GAMMA_CONSTEXPR constexpr
+  #define GAMMA_TABLES_CONSTEXPR
+#else
+  #define GAMMA_CONSTEXPR inline
+#endif
+
+struct GammaTable {
+  uint8_t values[256];
+};
+
+// Natural log for x > 0; reduced to [0.5, 1) then summed as 2*atanh((x-1)/(x+1))
+GAMMA_CONSTEXPR double GammaLog(double x) {
+  double e = 0;
+  while(x < 0.5) { x *= 2; e -= 1; }
+  while(x >= 1.0) { x /= 2; e += 1; }
+
+  double z = (x - 1) / (x + 1);
+  double z2 = z*z;
+  double term = z;
+  double sum = 0;
+  for(int k = 1; k < 60; k += 2) {
+    sum += term / k;
+    term *= z2;
+  }
+  return 2*sum + e*0.69314718055994530942;
+}
+
+// e^y; reduced to [-0.5, 0.5] by powers of 2 then summed as a Taylor series
+GAMMA_CONSTEXPR double GammaExp(double y) {
+  int n = 0;
+  while(y < -0.5) { y += 0.69314718055994530942; n--; }
+  while(y > 0.5) { y -= 0.69314718055994530942; n++; }
+
+  double term = 1;
+  double sum = 1;
+  for(int k = 1; k < 30; k++) {
+    term *= y / k;
+    sum += term;
+  }
+  for(; n < 0; n++) { sum /= 2; }
+  for(; n > 0; n--) { sum *= 2; }
+  return sum;
+}
+
+GAMMA_CONSTEXPR double GammaPow(double x, double y) {
+  return x <= 0 ? 0 : GammaExp(y * GammaLog(x));
+}
+
+// Forward matrix; every non-zero input maps to at least 1
+GAMMA_CONSTEXPR void BuildGammaTable(uint8_t* forward, float gamma, int max_in = 255, int max_out = 255) {
+  for(int i = 0; i <= 255; i++) {
+    forward[i] = i >= max_in ? max_out : (int)(GammaPow((float)i / (float)max_in, gamma) * max_out + 0.5);
+    if(i > 0 && forward[i] == 0) { forward[i] = 1; }
+  }
+}
+
+// Reverse matrix of BuildGammaTable(); inputs that share a forward value map back to the midpoint of their range
+GAMMA_CONSTEXPR void BuildReverseGammaTable(uint8_t* reverse, const uint8_t* forward, int max_out = 255) {
+  int iForward = 0;
+  int iScaledLast = -1;
+  for(int i = 0; i <= 255; i++) {
+    // Scale before lookup
+    int iScaled = i * max_out / 255;
+    if(iScaled == 0 && i > 0) { iScaled = 1; }
+    if(iScaledLast == iScaled) {
+      reverse[i] = reverse[i-1];
+      continue;
+    }
+    iScaledLast = iScaled;
+
+    if(iForward >= 255) {
+      reverse[i] = 255;
+    }
+    else if(forward[iForward] == forward[iForward+1]) {
+      int iForwardInit = iForward;
+      while(iForward <= 255 && forward[iForward] == forward[iForwardInit]) { iForward++; }
+      iForward--;
+      // indexes now span the range of gammas that match this index
+      reverse[i] = (iForward + iForwardInit) / 2;
+      iForward++;
+    }
+    else if(forward[iForward] == iScaled) {
+      reverse[i] = iForward;
+      iForward++;
+    }
+    else {
+      // Skipped a value in the gamma matrix; determine which one is closer to i
+      if(iScaled - forward[iForward - 1] <= forward[iForward] - iScaled) {
+        reverse[i] = iForward - 1;
+      }
+      else {
+        reverse[i] = iForward;
+      }
+    }
+  }
+}
+
+GAMMA_CONSTEXPR GammaTable MakeGammaTable(float gamma, int max_in = 255, int max_out = 255) {
+  GammaTable table = {};
+  BuildGammaTable(table.values, gamma, max_in, max_out);
+  return table;
+}
+
+GAMMA_CONSTEXPR GammaTable MakeReverseGammaTable(float gamma, int max_in = 255, int max_out = 255) {
+  GammaTable forward = MakeGammaTable(gamma, max_in, max_out);
+  GammaTable table = {};
+  BuildReverseGammaTable(table.values, forward.values, max_out);
+  return table;
+}
+
+// Gamma and dimming matrices rearranged so values read together share a cache line: the three channel gammas of an
+// input value sit in one 4-byte entry, and each level's 5-bit brightness sits next to its dim amount
+struct GammaInterleavedTables {
+  uint8_t rgb[256][4]; // gammaR, gammaG, gammaB, unused
+  uint8_t dim[256][2]; // gammaDim_5bit, gammaDim
+};
+
+GAMMA_CONSTEXPR GammaInterleavedTables MakeInterleavedTables(const uint8_t* gammaR, const uint8_t* gammaG, const uint8_t* gammaB,
+                                                             const uint8_t* gammaDim_5bit, const uint8_t* gammaDim) {
+  GammaInterleavedTables tables = {};
+  for(int i = 0; i <= 255; i++) {
+    tables.rgb[i][0] = gammaR[i];
+    tables.rgb[i][1] = gammaG[i];
+    tables.rgb[i][2] = gammaB[i];
+    tables.dim[i][0] = gammaDim_5bit[i];
+    tables.dim[i][1] = gammaDim[i];
+  }
+  return tables;
+}
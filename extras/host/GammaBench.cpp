@@ -0,0 +1,341 @@
+// Host micro-benchmarks of GammaManager's hot paths. Each line is the average time per pixel over repeated calls on
+// random colors; compare runs of the same build on the same machine, not against a board.
+//   gamma_bench [--quick] [section...]
+#include "GammaManager.h"
+#include "GammaReference.h"
+#include <stdio.h>
+#include <chrono>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+static double minSeconds = 0.2;
+
+static const uint16_t stripSizes[] = { 60, 300, 1000, 4000, 10000 };
+
+enum Distribution { DIST_FULL, DIST_RANDOM, DIST_GRADIENT, DIST_SPARSE, NUM_DISTRIBUTIONS };
+static const char* const distributionNames[] = { "full", "random", "gradient", "sparse" };
+
+// leds_b for one of the brightness distributions: all 255, random, a ramp along the strip, or mostly dark
+static void FillBrightness(uint8_t* leds_b, uint16_t count, Distribution dist) {
+  for(uint16_t i = 0; i < count; i++) {
+    if(dist == DIST_FULL) { leds_b[i] = 255; }
+    else if(dist == DIST_RANDOM) { leds_b[i] = 1 + random8(255); }
+    else if(dist == DIST_GRADIENT) { leds_b[i] = 1 + uint32_t(i) * 254 / count; }
+    else { leds_b[i] = random8() < 192 ? 0 : 1 + random8(255); }
+  }
+}
+
+static void FillRandomColors(CRGB* leds, uint16_t count) {
+  for(uint16_t i = 0; i < count; i++) { leds[i] = CRGB(random8(), random8(), random8()); }
+}
+
+// Calls fn until minSeconds have passed, after one warm-up call; returns nanoseconds per pixel
+template<typename F> static double NsPerPixel(uint32_t pixels, F fn) {
+  fn();
+  uint32_t calls = 0;
+  Clock::time_point start = Clock::now();
+  double elapsed;
+  do {
+    fn();
+    calls++;
+    elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+  } while(elapsed < minSeconds);
+  return elapsed * 1e9 / (double(calls) * pixels);
+}
+
+static void Report(const char* kernel, const char* variant, uint32_t pixels, double ns) {
+  printf("%-26s %-12s %6u  %8.2f ns/px  %8.1f Mpx/s\n", kernel, variant, pixels, ns, 1000.0 / ns);
+}
+
+// A strip with its own GammaManager. Prep writes into separate output buffers, so every call starts from the same leds[]
+struct BenchStrip {
+  uint16_t numLEDs;
+  std::vector<CRGB> leds;
+  std::vector<uint8_t> leds_b;
+  std::vector<uint8_t> leds_5bit;
+  std::vector<CRGB> out;
+  std::vector<uint8_t> out5bit;
+  uint8_t brightness;
+  CRGB corrections[32];
+  GammaManager gm;
+
+  BenchStrip(uint16_t n, Distribution dist) : numLEDs(n), leds(n), leds_b(n), leds_5bit(n), out(n), out5bit(n), brightness(128) {
+    FillRandomColors(&leds[0], n);
+    FillBrightness(&leds_b[0], n, dist);
+    gm.Init(&leds[0], &leds_b[0], &leds_5bit[0], n, &brightness);
+    gm.SetOutputBuffers(&out[0], &out5bit[0]);
+    gm.SetAllColorCorrections(0xFFB0F0);
+    for(uint8_t i = 0; i < 32; i++) { corrections[i] = CRGB(0xFFB0F0); }
+  }
+
+  // The original per-pixel loop over the same input, into the same output buffers
+  void ReferencePrep() {
+    ::ReferencePrep(&defaultGammaProfile, corrections, brightness, &leds[0], &leds_b[0], &out[0], &out5bit[0], numLEDs);
+  }
+};
+
+static void BenchPrep() {
+  printf("\nPrepPixelsForFastLED\n");
+  for(uint16_t n : stripSizes) {
+    for(uint8_t d = 0; d < NUM_DISTRIBUTIONS; d++) {
+      BenchStrip strip(n, Distribution(d));
+      Report("Prep", distributionNames[d], n, NsPerPixel(n, [&]() { strip.gm.PrepPixelsForFastLED(); }));
+    }
+    // A new globalBrightness every frame, so the per-level cache is refilled each call
+    BenchStrip strip(n, DIST_RANDOM);
+    Report("Prep, brightness changing", "random", n, NsPerPixel(n, [&]() {
+      strip.brightness ^= 1;
+      strip.gm.PrepPixelsForFastLED();
+    }));
+  }
+}
+
+static void BenchCorrectInverse() {
+  printf("\nCorrect/Inverse, one call per pixel\n");
+  for(uint16_t n : stripSizes) {
+    BenchStrip strip(n, DIST_FULL);
+    CRGB* pixels = &strip.leds[0];
+    Report("Correct", "", n, NsPerPixel(n, [&]() {
+      for(uint16_t i = 0; i < n; i++) { strip.gm.Correct(pixels[i]); }
+    }));
+    Report("Inverse", "", n, NsPerPixel(n, [&]() {
+      for(uint16_t i = 0; i < n; i++) { strip.gm.Inverse(pixels[i]); }
+    }));
+  }
+}
+
+static void BenchBlend() {
+  printf("\nBlend/BlendInPlace, one call per pixel\n");
+  for(uint16_t n : stripSizes) {
+    BenchStrip strip(n, DIST_FULL);
+    std::vector<CRGB> targets(n);
+    FillRandomColors(&targets[0], n);
+    CRGB* pixels = &strip.leds[0];
+    CRGB* results = &strip.out[0];
+    Report("Blend", "", n, NsPerPixel(n, [&]() {
+      for(uint16_t i = 0; i < n; i++) { results[i] = strip.gm.Blend(pixels[i], targets[i], 96); }
+    }));
+    Report("BlendInPlace", "", n, NsPerPixel(n, [&]() {
+      for(uint16_t i = 0; i < n; i++) { strip.gm.BlendInPlace(pixels[i], targets[i], 96); }
+    }));
+  }
+}
+
+// Scenes of solid segments with some dark ones, as effects that fill backgrounds and flat bands produce
+static void FillSegments(CRGB* leds, uint8_t* leds_b, uint16_t first, uint16_t last) {
+  uint16_t i = first;
+  while(i < last) {
+    uint16_t length = 30 + random8(60);
+    CRGB color(random8(), random8(), random8());
+    uint8_t b = random8() < 64 ? 0 : 1 + random8(255);
+    for(uint16_t j = 0; j < length && i < last; j++, i++) {
+      leds[i] = color;
+      leds_b[i] = b;
+    }
+  }
+}
+
+// Run reuse and dark-run clearing against the original per-pixel loop, on fill-heavy, mixed and all-different frames
+static void BenchRuns() {
+  printf("\nPrep on uniform runs, against the per-pixel loop\n");
+  const char* const frames[] = { "fill", "mixed", "random" };
+  for(uint16_t n : stripSizes) {
+    for(uint8_t f = 0; f < 3; f++) {
+      BenchStrip strip(n, DIST_RANDOM);
+      if(f == 0) { FillSegments(&strip.leds[0], &strip.leds_b[0], 0, n); }
+      else if(f == 1) {
+        // Alternating bands of solid segments and noise
+        for(uint16_t start = 0; start < n; start += 200) {
+          if((start / 200) % 2 == 0) { FillSegments(&strip.leds[0], &strip.leds_b[0], start, min(uint16_t(start + 200), n)); }
+        }
+      }
+      Report("Per-pixel loop", frames[f], n, NsPerPixel(n, [&]() { strip.ReferencePrep(); }));
+      Report("Prep", frames[f], n, NsPerPixel(n, [&]() { strip.gm.PrepPixelsForFastLED(); }));
+    }
+  }
+}
+
+// CorrectRange/InverseRange and BlendRange against the same work done one call per pixel
+static void BenchRangeKernels() {
+  printf("\nBatch kernels, against one call per pixel\n");
+  for(uint16_t n : stripSizes) {
+    BenchStrip strip(n, DIST_FULL);
+    std::vector<CRGB> targets(n);
+    FillRandomColors(&targets[0], n);
+    CRGB* pixels = &strip.leds[0];
+    Report("Correct per pixel", "", n, NsPerPixel(n, [&]() {
+      for(uint16_t i = 0; i < n; i++) { strip.gm.Correct(pixels[i]); }
+    }));
+    Report("CorrectRange", "", n, NsPerPixel(n, [&]() { strip.gm.CorrectRange(pixels, n); }));
+    Report("Inverse per pixel", "", n, NsPerPixel(n, [&]() {
+      for(uint16_t i = 0; i < n; i++) { strip.gm.Inverse(pixels[i]); }
+    }));
+    Report("InverseRange", "", n, NsPerPixel(n, [&]() { strip.gm.InverseRange(pixels, n); }));
+    Report("BlendInPlace per pixel", "", n, NsPerPixel(n, [&]() {
+      for(uint16_t i = 0; i < n; i++) { strip.gm.BlendInPlace(pixels[i], targets[i], 96); }
+    }));
+    Report("BlendRange", "", n, NsPerPixel(n, [&]() { strip.gm.BlendRange(pixels, &targets[0], n, 96); }));
+  }
+}
+
+// The same frames from separate leds[]/leds_b[] arrays and from packed GammaPixels, on random and fill-heavy scenes
+static void BenchLayout() {
+  printf("\nPrep from split arrays, against packed pixels\n");
+  const char* const frames[] = { "random", "fill" };
+  for(uint16_t n : stripSizes) {
+    for(uint8_t f = 0; f < 2; f++) {
+      BenchStrip strip(n, DIST_RANDOM);
+      if(f == 1) { FillSegments(&strip.leds[0], &strip.leds_b[0], 0, n); }
+      std::vector<GammaPixel> packed(n);
+      for(uint16_t i = 0; i < n; i++) {
+        packed[i].r = strip.leds[i].r;
+        packed[i].g = strip.leds[i].g;
+        packed[i].b = strip.leds[i].b;
+        packed[i].brightness = strip.leds_b[i];
+      }
+      Report("Prep split", frames[f], n, NsPerPixel(n, [&]() { strip.gm.PrepPixelsForFastLED(); }));
+      strip.gm.SetPackedBuffer(&packed[0]);
+      Report("Prep packed", frames[f], n, NsPerPixel(n, [&]() { strip.gm.PrepPixelsForFastLED(); }));
+    }
+  }
+}
+
+// Prep with the profile's separate tables, against the interleaved layout in const memory and as a RAM copy, from leds[] and
+// from a linear buffer (which reads the output gammas per pixel). Brightness changes every frame, so the dim tables are read too
+static void BenchTables() {
+  printf("\nPrep with separate tables, against interleaved\n");
+  static GammaInterleavedTables ramTables;
+  BuildInterleavedTables(&ramTables, &defaultGammaProfile);
+  struct Layout {
+    const char* name;
+    const GammaInterleavedTables* tables;
+  };
+  const Layout layouts[] = {
+    { "Prep separate", NULL },
+    #ifdef GAMMA_TABLES_CONSTEXPR
+      { "Prep interleaved const", &defaultInterleavedTables },
+    #endif
+    { "Prep interleaved RAM", &ramTables },
+  };
+  for(uint16_t n : stripSizes) {
+    for(const Layout& layout : layouts) {
+      BenchStrip strip(n, DIST_RANDOM);
+      if(layout.tables != NULL) { strip.gm.SetInterleavedTables(layout.tables); }
+      Report(layout.name, "8-bit", n, NsPerPixel(n, [&]() {
+        strip.brightness ^= 1;
+        strip.gm.PrepPixelsForFastLED();
+      }));
+      std::vector<CRGB16> linear(n);
+      for(uint16_t i = 0; i < n; i++) { linear[i] = { random16(), random16(), random16() }; }
+      strip.gm.SetLinearBuffer(&linear[0]);
+      Report(layout.name, "linear", n, NsPerPixel(n, [&]() {
+        strip.brightness ^= 1;
+        strip.gm.PrepPixelsForFastLED();
+      }));
+    }
+  }
+}
+
+// A simulated SPI bus with DMA: sending a chunk returns at once and the bus stays busy for nsPerByte per byte. As the sink
+// contract requires, a new chunk first waits for the previous one to finish
+struct SimulatedWire {
+  double nsPerByte;
+  Clock::time_point busyUntil;
+
+  SimulatedWire(double ns) : nsPerByte(ns), busyUntil(Clock::now()) {}
+
+  void Wait() {
+    while(Clock::now() < busyUntil) {}
+  }
+
+  void Send(uint16_t length) {
+    Wait();
+    busyUntil = Clock::now() + std::chrono::nanoseconds(uint64_t(length * nsPerByte));
+  }
+
+  static void Sink(const uint8_t* data, uint16_t length, void* context) {
+    SimulatedWire* wire = (SimulatedWire*)context;
+    if(data == NULL) { wire->Wait(); }
+    else { wire->Send(length); }
+  }
+};
+
+// PrepAPA102Frame() followed by sending the whole frame, against PrepAPA102Pipelined() sending each chunk while the next
+// is corrected. The wire is scaled to the host's speed, at about as many nanoseconds per pixel as Prep takes, much as a
+// 10-20MHz SPI bus compares to Prep on an ESP32; the time per pixel covers the whole frame, up to the last byte sent
+static void BenchPipelined() {
+  printf("\nAPA102 frame then send, against pipelined chunks\n");
+  const uint16_t chunkSizes[] = { 32, 128, 512 };
+  for(uint16_t n : stripSizes) {
+    BenchStrip strip(n, DIST_RANDOM);
+    std::vector<uint8_t> frame(strip.gm.APA102FrameSize());
+    double prepNs = NsPerPixel(n, [&]() { strip.gm.PrepAPA102Frame(&frame[0]); });
+    Report("APA102 frame only", "", n, prepNs);
+    SimulatedWire wire(prepNs / 4);
+    Report("Frame, then send", "", n, NsPerPixel(n, [&]() {
+      uint32_t size = strip.gm.PrepAPA102Frame(&frame[0]);
+      for(uint32_t sent = 0; sent < size; sent += 65535) { wire.Send(min(size - sent, uint32_t(65535))); }
+      wire.Wait();
+    }));
+    for(uint16_t chunkPixels : chunkSizes) {
+      if(chunkPixels > n) { continue; }
+      std::vector<uint8_t> buffer0(4*chunkPixels), buffer1(4*chunkPixels);
+      char variant[16];
+      snprintf(variant, sizeof(variant), "%u px", chunkPixels);
+      Report("Pipelined", variant, n, NsPerPixel(n, [&]() {
+        strip.gm.PrepAPA102Pipelined(&buffer0[0], &buffer1[0], chunkPixels, SimulatedWire::Sink, &wire);
+      }));
+    }
+  }
+}
+
+#ifdef GAMMA_PARALLEL_PREP
+// Prep split across the calling thread and the worker task, against the same strip prepped serially.
+// The worker task never exits, so these strips are never freed
+static void BenchParallel() {
+  printf("\nParallel Prep, against serial\n");
+  for(uint16_t n : stripSizes) {
+    for(uint8_t d = DIST_FULL; d <= DIST_RANDOM; d++) {
+      BenchStrip& strip = *new BenchStrip(n, Distribution(d));
+      Report("Prep serial", distributionNames[d], n, NsPerPixel(n, [&]() { strip.gm.PrepPixelsForFastLED(); }));
+      strip.gm.EnableParallelPrep(true);
+      Report("Prep parallel", distributionNames[d], n, NsPerPixel(n, [&]() { strip.gm.PrepPixelsForFastLED(); }));
+    }
+  }
+}
+#endif
+
+struct BenchSection {
+  const char* name;
+  void (*run)();
+};
+
+static const BenchSection sections[] = {
+  { "prep", BenchPrep },
+  { "correct", BenchCorrectInverse },
+  { "blend", BenchBlend },
+  { "runs", BenchRuns },
+  { "range", BenchRangeKernels },
+  { "layout", BenchLayout },
+  { "tables", BenchTables },
+  { "pipelined", BenchPipelined },
+  #ifdef GAMMA_PARALLEL_PREP
+    { "parallel", BenchParallel },
+  #endif
+};
+
+int main(int argc, char** argv) {
+  std::vector<const char*> selected;
+  for(int i = 1; i < argc; i++) {
+    if(strcmp(argv[i], "--quick") == 0) { minSeconds = 0.02; }
+    else { selected.push_back(argv[i]); }
+  }
+
+  for(const BenchSection& section : sections) {
+    bool run = selected.empty();
+    for(const char* name : selected) { run = run || strcmp(name, section.name) == 0; }
+    if(run) { section.run(); }
+  }
+  return 0;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include "GammaManager.h"
+
+// The original per-pixel PrepPixelsForFastLED(), from before the Prep cache, run reuse and the other fast paths.
+// Reads in[]/in_b[] and writes out[]/out5bit[], with colorCorrections indexed by 5-bit brightness as in GammaManager
+inline void ReferencePrep(const GammaProfile* profile, const CRGB* colorCorrections, uint8_t globalBrightness,
+                          const CRGB* in, const uint8_t* in_b, CRGB* out, uint8_t* out5bit, uint16_t count) {
+  for(uint16_t i = 0; i < count; i++) {
+    out[i] = in[i];
+    if(globalBrightness == 0 || in_b[i] == 0) {
+      out5bit[i] = 0;
+      continue;
+    }
+
+    uint16_t brightness = globalBrightness * in_b[i] / 0xFF;
+    if(brightness == 0) { brightness = 1; }
+    out5bit[i] = pgm_read_byte(&profile->gammaDim_5bit[brightness]);
+
+    uint8_t dimAmount = pgm_read_byte(&profile->gammaDim[brightness]);
+    CRGB correction = colorCorrections[out5bit[i]];
+    correction.nscale8_video(dimAmount);
+    out[i].nscale8(correction);
+    out[i].r = pgm_read_byte(&profile->gammaR[out[i].r]);
+    out[i].g = pgm_read_byte(&profile->gammaG[out[i].g]);
+    out[i].b = pgm_read_byte(&profile->gammaB[out[i].b]);
+  }
+}
@@ -0,0 +1,974 @@
+// Host regression tests of GammaManager's optimized paths against the original per-pixel code in GammaReference.h.
+// ctest runs each test on its own; with no arguments every test runs:
+//   gamma_tests [test...]
+#include "GammaManager.h"
+#include "GammaReference.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+static uint32_t failures = 0;
+
+// Reports a failed check; only the first few are printed
+static void Fail(const char* file, int line, const char* message) {
+  if(failures++ < 10) { fprintf(stderr, "%s:%d: %s\n", file, line, message); }
+}
+
+#define CHECK(cond) do { if(!(cond)) { Fail(__FILE__, __LINE__, "CHECK(" #cond ") failed"); } } while(0)
+#define CHECK_PIXELS(...) CheckPixels(__FILE__, __LINE__, __VA_ARGS__)
+
+// Compares Prep output with the reference, allowing tolerance per channel. Colors of dark pixels are only compared when
+// compareDark is set, since only in-place Prep defines them (they keep the uncorrected color). Reports the first mismatch
+static void CheckPixels(const char* file, int line, const char* what, const CRGB* expected, const uint8_t* expected5bit,
+                        const CRGB* actual, const uint8_t* actual5bit, uint16_t count, bool compareDark, uint8_t tolerance = 0) {
+  for(uint16_t i = 0; i < count; i++) {
+    bool colorsMatch = abs(actual[i].r - expected[i].r) <= tolerance && abs(actual[i].g - expected[i].g) <= tolerance &&
+                       abs(actual[i].b - expected[i].b) <= tolerance;
+    if(actual5bit[i] != expected5bit[i] || (!colorsMatch && (compareDark || expected5bit[i] != 0))) {
+      char message[160];
+      snprintf(message, sizeof(message), "%s: pixel %u expected %u,%u,%u/%u, got %u,%u,%u/%u", what, i,
+               expected[i].r, expected[i].g, expected[i].b, expected5bit[i], actual[i].r, actual[i].g, actual[i].b, actual5bit[i]);
+      Fail(file, line, message);
+      return;
+    }
+  }
+}
+
+// Compares the LED frames of an APA102 SPI frame with the reference; dark pixels must be sent as black
+static void CheckAPA102(const char* what, const uint8_t* frame, const CRGB* expected, const uint8_t* expected5bit, uint16_t count) {
+  std::vector<CRGB> actual(count);
+  std::vector<uint8_t> actual5bit(count);
+  std::vector<CRGB> sent(expected, expected + count);
+  for(uint16_t i = 0; i < count; i++) {
+    const uint8_t* p = &frame[4 + 4*i];
+    actual5bit[i] = p[0] & 0x1F;
+    actual[i] = CRGB(p[1], p[2], p[3]);
+    CHECK((p[0] & 0xE0) == 0xE0);
+    if(expected5bit[i] == 0) { sent[i] = CRGB::Black; }
+  }
+  CHECK_PIXELS(what, &sent[0], expected5bit, &actual[0], &actual5bit[0], count, true);
+}
+
+// A strip with its own GammaManager. Effects "draw" scene[]/scene_b[] into leds[]/leds_b[]; ref[]/ref5bit[] hold the
+// reference Prep of the scene. Each 5-bit level gets its own color correction, so a correction read at the wrong level shows
+struct TestStrip {
+  uint16_t numLEDs;
+  std::vector<CRGB> scene;
+  std::vector<uint8_t> scene_b;
+  std::vector<CRGB> leds;
+  std::vector<uint8_t> leds_b;
+  std::vector<uint8_t> leds_5bit;
+  std::vector<CRGB> ref;
+  std::vector<uint8_t> ref5bit;
+  uint8_t brightness;
+  CRGB corrections[32];
+  GammaManager gm;
+
+  TestStrip(uint16_t n, uint8_t _brightness = 128) : numLEDs(n), scene(n), scene_b(n), leds(n), leds_b(n), leds_5bit(n), ref(n), ref5bit(n), brightness(_brightness) {
+    gm.Init(&leds[0], &leds_b[0], &leds_5bit[0], n, &brightness);
+    for(uint8_t i = 0; i < 32; i++) {
+      corrections[i] = CRGB(255 - 2*i, 176 + i, 240 - 3*i);
+      gm.SetColorCorrection(i, corrections[i]);
+    }
+  }
+
+  void Draw(uint16_t first, uint16_t last) {
+    for(uint16_t i = first; i < last; i++) {
+      leds[i] = scene[i];
+      leds_b[i] = scene_b[i];
+    }
+  }
+
+  void Draw() { Draw(0, numLEDs); }
+
+  void Reference(uint8_t atBrightness) {
+    ReferencePrep(&defaultGammaProfile, corrections, atBrightness, &scene[0], &scene_b[0], &ref[0], &ref5bit[0], numLEDs);
+  }
+
+  void Reference() { Reference(brightness); }
+};
+
+// Random colors and leds_b with runs, repeating independently to exercise Prep's run reuse, and some dark pixels
+static void RandomScene(CRGB* leds, uint8_t* leds_b, uint16_t first, uint16_t last) {
+  for(uint16_t i = first; i < last; i++) {
+    leds[i] = i > first && random8() < 96 ? leds[i-1] : CRGB(random8(), random8(), random8());
+    leds_b[i] = i > first && random8() < 96 ? leds_b[i-1] : (random8() < 32 ? 0 : random8());
+  }
+}
+
+static void RandomScene(TestStrip& strip) {
+  RandomScene(&strip.scene[0], &strip.scene_b[0], 0, strip.numLEDs);
+}
+
+static void PackScene(const TestStrip& strip, GammaPixel* packed) {
+  for(uint16_t i = 0; i < strip.numLEDs; i++) {
+    packed[i].r = strip.scene[i].r;
+    packed[i].g = strip.scene[i].g;
+    packed[i].b = strip.scene[i].b;
+    packed[i].brightness = strip.scene_b[i];
+  }
+}
+
+// Every channel value at every leds_b and global brightness, through the CRGB, interleaved table, packed and APA102 paths
+static void TestPrepExhaustive() {
+  const uint16_t N = 256;
+  TestStrip strip(N);
+  std::vector<GammaPixel> packed(N);
+  std::vector<uint8_t> frame(strip.gm.APA102FrameSize());
+  for(uint16_t g = 0; g <= 255; g++) {
+    strip.brightness = g;
+    for(uint16_t b = 0; b <= 255; b++) {
+      for(uint16_t i = 0; i < N; i++) {
+        strip.scene[i] = CRGB(i, 255 - i, i ^ 0xA5);
+        strip.scene_b[i] = b;
+      }
+      strip.Reference();
+
+      strip.Draw();
+      strip.gm.PrepPixelsForFastLED();
+      CHECK_PIXELS("Prep", &strip.ref[0], &strip.ref5bit[0], &strip.leds[0], &strip.leds_5bit[0], N, true);
+
+      strip.Draw();
+      strip.gm.SetInterleavedTables(&defaultInterleavedTables);
+      strip.gm.PrepPixelsForFastLED();
+      strip.gm.SetInterleavedTables(NULL);
+      CHECK_PIXELS("Interleaved Prep", &strip.ref[0], &strip.ref5bit[0], &strip.leds[0], &strip.leds_5bit[0], N, true);
+
+      PackScene(strip, &packed[0]);
+      strip.gm.SetPackedBuffer(&packed[0]);
+      strip.gm.PrepPixelsForFastLED();
+      strip.gm.SetPackedBuffer(NULL);
+      CHECK_PIXELS("Packed Prep", &strip.ref[0], &strip.ref5bit[0], &strip.leds[0], &strip.leds_5bit[0], N, false);
+
+      strip.Draw();
+      strip.gm.PrepAPA102Frame(&frame[0], RGB);
+      CheckAPA102("APA102", &frame[0], &strip.ref[0], &strip.ref5bit[0], N);
+      CHECK(strip.leds == strip.scene);
+    }
+  }
+}
+
+// Random frames through in-place, output buffer, linear (with separate and interleaved tables) and indexed Prep
+static void TestPrepRandom() {
+  const uint16_t N = 300;
+  TestStrip strip(N);
+  static GammaInterleavedTables ramTables;
+  BuildInterleavedTables(&ramTables, &defaultGammaProfile);
+  std::vector<CRGB> out(N);
+  std::vector<uint8_t> out5bit(N);
+  std::vector<CRGB16> linear(N);
+  std::vector<uint8_t> indices(N);
+  const uint16_t PALETTE_SIZE = 64;
+  std::vector<GammaPixel> palette(PALETTE_SIZE), preparedPalette(PALETTE_SIZE);
+  for(uint16_t frameNum = 0; frameNum < 2048; frameNum++) {
+    strip.brightness = random8();
+    RandomScene(strip);
+    strip.Reference();
+
+    strip.Draw();
+    strip.gm.PrepPixelsForFastLED();
+    CHECK_PIXELS("Prep", &strip.ref[0], &strip.ref5bit[0], &strip.leds[0], &strip.leds_5bit[0], N, true);
+
+    strip.Draw();
+    strip.gm.SetOutputBuffers(&out[0], &out5bit[0]);
+    strip.gm.PrepPixelsForFastLED();
+    strip.gm.SetOutputBuffers(NULL, NULL);
+    CHECK_PIXELS("Output buffer", &strip.ref[0], &strip.ref5bit[0], &out[0], &out5bit[0], N, false);
+    CHECK(strip.leds == strip.scene);
+
+    // The linear buffer trades one rounding step for headroom; allow 1 per channel
+    for(uint16_t i = 0; i < N; i++) {
+      linear[i].r = strip.scene[i].r << 8;
+      linear[i].g = strip.scene[i].g << 8;
+      linear[i].b = strip.scene[i].b << 8;
+    }
+    strip.Draw();
+    strip.gm.SetLinearBuffer(&linear[0]);
+    strip.gm.PrepPixelsForFastLED();
+    CHECK_PIXELS("Linear Prep", &strip.ref[0], &strip.ref5bit[0], &strip.leds[0], &strip.leds_5bit[0], N, false, 1);
+
+    // Interleaved tables hold the same gammas, read with a stride, so the linear output must not change at all
+    std::vector<CRGB> linearOut = strip.leds;
+    std::vector<uint8_t> linearOut5bit = strip.leds_5bit;
+    strip.gm.SetInterleavedTables(&ramTables);
+    strip.gm.PrepPixelsForFastLED();
+    strip.gm.SetInterleavedTables(NULL);
+    strip.gm.SetLinearBuffer(NULL);
+    CHECK_PIXELS("Interleaved linear Prep", &linearOut[0], &linearOut5bit[0], &strip.leds[0], &strip.leds_5bit[0], N, false);
+
+    // Indexed Prep, with the scene's first pixels as the palette
+    for(uint16_t i = 0; i < PALETTE_SIZE; i++) {
+      palette[i].r = strip.scene[i].r;
+      palette[i].g = strip.scene[i].g;
+      palette[i].b = strip.scene[i].b;
+      palette[i].brightness = strip.scene_b[i];
+    }
+    for(uint16_t i = 0; i < N; i++) {
+      indices[i] = random8(PALETTE_SIZE);
+      const GammaPixel& entry = palette[indices[i]];
+      strip.scene[i] = CRGB(entry.r, entry.g, entry.b);
+      strip.scene_b[i] = entry.brightness;
+    }
+    strip.Reference();
+    strip.gm.SetIndexedBuffer(&indices[0], &palette[0], &preparedPalette[0], PALETTE_SIZE);
+    strip.gm.PrepPixelsForFastLED();
+    strip.gm.SetIndexedBuffer(NULL, NULL, NULL, 0);
+    CHECK_PIXELS("Indexed Prep", &strip.ref[0], &strip.ref5bit[0], &strip.leds[0], &strip.leds_5bit[0], N, false);
+  }
+}
+
+enum DirtyMode { DIRTY_IN_PLACE, DIRTY_PACKED, DIRTY_OUTPUT_BUFFER, DIRTY_DOUBLE_BUFFER };
+
+// Frames that redraw random ranges and mark them dirty, with occasional brightness changes, ramps and spells of power
+// estimation, checking the whole output against the reference each frame. In place, the app redraws everything whenever NeedsFullRedraw() asks
+static void RunDirtyFrames(DirtyMode mode) {
+  const uint16_t N = 300;
+  TestStrip strip(N);
+  std::vector<GammaPixel> packed(N);
+  std::vector<CRGB> out0(N), out1(N);
+  std::vector<uint8_t> out0_5bit(N), out1_5bit(N);
+  if(mode == DIRTY_PACKED) { strip.gm.SetPackedBuffer(&packed[0]); }
+  if(mode == DIRTY_OUTPUT_BUFFER) { strip.gm.SetOutputBuffers(&out0[0], &out0_5bit[0]); }
+  if(mode == DIRTY_DOUBLE_BUFFER) { strip.gm.SetOutputBuffers(&out0[0], &out0_5bit[0], &out1[0], &out1_5bit[0]); }
+  strip.gm.EnableDirtyTracking(true);
+
+  RandomScene(strip);
+  strip.Draw();
+  PackScene(strip, &packed[0]);
+  CRGB* lastFront = NULL;
+  for(uint16_t frameNum = 0; frameNum < 2048; frameNum++) {
+    SetHostMillis(uint32_t(frameNum) * 20);
+    if(frameNum > 0) {
+      if(random8() < 16) { strip.brightness = random8(); }
+      if(random8() < 4) { strip.gm.RampBrightness(random8(), 500); }
+      if(random8() < 8) { strip.gm.EnablePowerEstimate(random8() & 1); }
+      if(mode == DIRTY_IN_PLACE && strip.gm.NeedsFullRedraw()) {
+        strip.Draw();
+      }
+      else {
+        // Short ranges, sometimes more than the spans kept separately. In place, only what GetDirtySpan() reports is redrawn,
+        // which must be just the marked pixels until spans have to merge
+        uint8_t ranges = random8(2 * GAMMA_MAX_DIRTY_SPANS);
+        std::vector<bool> marked(N);
+        for(uint8_t r = ranges; r > 0; r--) {
+          uint16_t first = random16() % N;
+          uint16_t last = first + random16() % min(N - first + 1, 40);
+          RandomScene(&strip.scene[0], &strip.scene_b[0], first, last);
+          strip.Draw(first, last);
+          strip.gm.MarkDirty(first, last - first);
+          for(uint16_t i = first; i < last; i++) { marked[i] = true; }
+        }
+        uint16_t start, end, lastEnd = 0;
+        for(uint8_t s = 0; strip.gm.GetDirtySpan(s, start, end); s++) {
+          // Sorted, and apart, since touching spans join
+          CHECK(s < GAMMA_MAX_DIRTY_SPANS && start < end && (s == 0 || start > lastEnd));
+          lastEnd = end;
+          if(ranges <= GAMMA_MAX_DIRTY_SPANS) {
+            for(uint16_t i = start; i < end; i++) { CHECK(marked[i]); }
+          }
+          if(mode == DIRTY_IN_PLACE) { strip.Draw(start, end); }
+        }
+        PackScene(strip, &packed[0]);
+      }
+    }
+    strip.gm.PrepPixelsForFastLED();
+    strip.Reference();
+    CHECK_PIXELS("Dirty Prep", &strip.ref[0], &strip.ref5bit[0], strip.gm.GetOutputLeds(), strip.gm.GetOutput5bitBrightness(), N, mode == DIRTY_IN_PLACE);
+    if(mode == DIRTY_OUTPUT_BUFFER || mode == DIRTY_DOUBLE_BUFFER) { CHECK(strip.leds == strip.scene); }
+    if(mode == DIRTY_DOUBLE_BUFFER) {
+      CHECK(strip.gm.GetOutputLeds() != lastFront);
+      lastFront = strip.gm.GetOutputLeds();
+    }
+  }
+}
+
+static void TestPrepDirtyInPlace() { RunDirtyFrames(DIRTY_IN_PLACE); }
+static void TestPrepDirtyPacked() { RunDirtyFrames(DIRTY_PACKED); }
+static void TestPrepDirtyOutputBuffer() { RunDirtyFrames(DIRTY_OUTPUT_BUFFER); }
+static void TestPrepDoubleBuffer() { RunDirtyFrames(DIRTY_DOUBLE_BUFFER); }
+
+// RampBrightness() steps *globalBrightness once per Prep as millis() advances, and each frame matches the reference at that brightness
+static void TestRamp() {
+  const uint16_t N = 300;
+  TestStrip strip(N, 20);
+  std::vector<CRGB> out(N);
+  std::vector<uint8_t> out5bit(N);
+  std::vector<uint8_t> frame(strip.gm.APA102FrameSize());
+  strip.gm.SetOutputBuffers(&out[0], &out5bit[0]);
+  RandomScene(strip);
+  strip.Draw();
+
+  SetHostMillis(1000);
+  strip.gm.RampBrightness(220, 1000);
+  CHECK(strip.gm.IsRamping());
+  for(uint32_t t = 0; t <= 1100; t += 50) {
+    SetHostMillis(1000 + t);
+    strip.gm.PrepPixelsForFastLED();
+    CHECK(strip.brightness == (t >= 1000 ? 220 : 20 + 200 * t / 1000));
+    CHECK(strip.gm.IsRamping() == (t < 1000));
+    strip.Reference();
+    CHECK_PIXELS("Ramp", &strip.ref[0], &strip.ref5bit[0], &out[0], &out5bit[0], N, false);
+  }
+
+  // The APA102 paths advance the ramp too
+  strip.gm.RampBrightness(0, 1000);
+  SetHostMillis(2600);
+  strip.gm.PrepAPA102Frame(&frame[0], RGB);
+  CHECK(strip.brightness == 110);
+  strip.Reference();
+  CheckAPA102("APA102 ramp", &frame[0], &strip.ref[0], &strip.ref5bit[0], N);
+
+  // Writing *globalBrightness cancels the ramp
+  strip.brightness = 150;
+  SetHostMillis(2700);
+  strip.gm.PrepPixelsForFastLED();
+  CHECK(!strip.gm.IsRamping());
+  CHECK(strip.brightness == 150);
+
+  // Scheduled dimming runs for hours, in both directions
+  const uint32_t HOUR = 3600000UL;
+  for(uint8_t down = 0; down < 2; down++) {
+    strip.brightness = down ? 255 : 0;
+    SetHostMillis(5000);
+    strip.gm.RampBrightness(down ? 0 : 255, 3 * HOUR);
+    for(uint32_t t = 0; t <= 3 * HOUR; t += HOUR / 8) {
+      SetHostMillis(5000 + t);
+      strip.gm.PrepPixelsForFastLED();
+      uint8_t moved = uint64_t(255) * t / (3 * HOUR);
+      CHECK(strip.brightness == (down ? 255 - moved : moved));
+    }
+    CHECK(!strip.gm.IsRamping());
+  }
+}
+
+// Milliamps the power model gives for reference output
+static uint32_t ReferenceMilliamps(const TestStrip& strip, const uint8_t* model) {
+  uint64_t driven = 0;
+  for(uint16_t i = 0; i < strip.numLEDs; i++) {
+    const CRGB& p = strip.ref[i];
+    driven += uint32_t(p.r * model[0] + p.g * model[1] + p.b * model[2]) * strip.ref5bit[i];
+  }
+  return uint32_t(strip.numLEDs) * model[3] + uint32_t(driven / (255 * 31));
+}
+
+// The power estimate matches the model applied to the reference output, and a power limit holds the estimate under it
+static void TestPower() {
+  const uint16_t N = 300;
+  TestStrip strip(N);
+  std::vector<uint8_t> frame(strip.gm.APA102FrameSize());
+  const uint8_t defaultModel[4] = { 16, 11, 15, 1 };
+  const uint8_t model[4] = { 20, 20, 20, 0 };
+  strip.gm.EnablePowerEstimate(true);
+  for(uint16_t frameNum = 0; frameNum < 1024; frameNum++) {
+    strip.brightness = random8();
+    RandomScene(strip);
+    strip.Draw();
+    strip.Reference();
+    strip.gm.PrepPixelsForFastLED();
+    CHECK(strip.gm.GetEstimatedMilliamps() == ReferenceMilliamps(strip, defaultModel));
+    strip.Draw();
+    strip.gm.PrepAPA102Frame(&frame[0]);
+    CHECK(strip.gm.GetEstimatedMilliamps() == ReferenceMilliamps(strip, defaultModel));
+  }
+  strip.gm.SetPowerModel(model[0], model[1], model[2], model[3]);
+  strip.gm.PrepAPA102Frame(&frame[0]);
+  CHECK(strip.gm.GetEstimatedMilliamps() == ReferenceMilliamps(strip, model));
+
+  // Full white draws 18A; limited to 3A, frames settle under the limit at a lower brightness and look like the reference there
+  const uint32_t LIMIT = 3000;
+  strip.brightness = 255;
+  for(uint16_t i = 0; i < N; i++) {
+    strip.scene[i] = CRGB::White;
+    strip.scene_b[i] = 255;
+  }
+  strip.gm.SetPowerLimit(LIMIT);
+  for(uint8_t frameNum = 0; frameNum < 16; frameNum++) {
+    strip.Draw();
+    strip.gm.PrepPixelsForFastLED();
+    if(frameNum < 2) { continue; }
+    CHECK(strip.gm.GetEstimatedMilliamps() <= LIMIT);
+    CHECK(strip.gm.GetEstimatedMilliamps() >= LIMIT / 2);
+    int16_t level = strip.brightness;
+    for(; level >= 0; level--) {
+      strip.Reference(level);
+      if(strip.ref5bit == strip.leds_5bit && strip.ref == strip.leds) { break; }
+    }
+    CHECK(level >= 0 && level < 255);
+  }
+  CHECK(strip.brightness == 255);
+
+  strip.gm.SetPowerLimit(0);
+  strip.Draw();
+  strip.gm.PrepPixelsForFastLED();
+  strip.Reference();
+  CHECK_PIXELS("Power limit removed", &strip.ref[0], &strip.ref5bit[0], &strip.leds[0], &strip.leds_5bit[0], N, true);
+}
+
+// Collects the chunks PrepAPA102Pipelined() sends
+struct ChunkCollector {
+  std::vector<uint8_t> bytes;
+  uint32_t chunks = 0;
+  uint32_t ends = 0;
+
+  static void Sink(const uint8_t* data, uint16_t length, void* context) {
+    ChunkCollector* collector = (ChunkCollector*)context;
+    if(data == NULL) {
+      collector->ends++;
+      return;
+    }
+    collector->chunks++;
+    collector->bytes.insert(collector->bytes.end(), data, data + length);
+  }
+};
+
+// The pipelined stream matches PrepAPA102Frame() for any valid chunk size, and chunk sizes it can't stream send nothing
+static void TestAPA102Pipelined() {
+  const uint16_t N = 1000;
+  TestStrip strip(N);
+  RandomScene(strip);
+  strip.Draw();
+  strip.Reference();
+  std::vector<uint8_t> frame(strip.gm.APA102FrameSize());
+  CHECK(strip.gm.PrepAPA102Frame(&frame[0], GRB) == frame.size());
+
+  const uint16_t chunkSizes[] = { 1, 7, 32, 999, 1000, 4096, APA102_MAX_CHUNK_PIXELS };
+  for(uint16_t chunkPixels : chunkSizes) {
+    std::vector<uint8_t> buffer0(4*chunkPixels), buffer1(4*chunkPixels);
+    ChunkCollector collector;
+    strip.gm.PrepAPA102Pipelined(&buffer0[0], &buffer1[0], chunkPixels, ChunkCollector::Sink, &collector, GRB);
+    CHECK(collector.bytes == frame);
+    CHECK(collector.ends == 1);
+  }
+
+  std::vector<uint8_t> buffer(4);
+  const uint16_t badSizes[] = { 0, APA102_MAX_CHUNK_PIXELS + 1, 65535 };
+  for(uint16_t chunkPixels : badSizes) {
+    ChunkCollector collector;
+    strip.gm.PrepAPA102Pipelined(&buffer[0], &buffer[0], chunkPixels, ChunkCollector::Sink, &collector);
+    CHECK(collector.chunks == 0 && collector.ends == 0);
+  }
+
+  strip.gm.PrepAPA102Frame(&frame[0], RGB);
+  CheckAPA102("APA102", &frame[0], &strip.ref[0], &strip.ref5bit[0], N);
+}
+
+// CorrectRange/InverseRange and every BlendRange overload against the same calls made one pixel at a time
+static void TestRangeKernels() {
+  const uint16_t N = 1003; // Not a multiple of the unrolled block size
+  TestStrip strip(N);
+  std::vector<CRGB> pixels(N), targets(N), expected(N), actual(N);
+  std::vector<fract8> amounts(N);
+  for(uint8_t round = 0; round < 16; round++) {
+    for(uint16_t i = 0; i < N; i++) {
+      pixels[i] = CRGB(random8(), random8(), random8());
+      targets[i] = CRGB(random8(), random8(), random8());
+      amounts[i] = random8();
+    }
+
+    expected = actual = pixels;
+    for(uint16_t i = 0; i < N; i++) { strip.gm.Correct(expected[i]); }
+    strip.gm.CorrectRange(&actual[0], N);
+    CHECK(actual == expected);
+
+    expected = actual = pixels;
+    for(uint16_t i = 0; i < N; i++) { strip.gm.Inverse(expected[i]); }
+    strip.gm.InverseRange(&actual[0], N);
+    CHECK(actual == expected);
+
+    fract8 amount = random8();
+    expected = actual = pixels;
+    for(uint16_t i = 0; i < N; i++) {
+      CRGB blended = strip.gm.Blend(expected[i], targets[i], amount);
+      strip.gm.BlendInPlace(expected[i], targets[i], amount);
+      CHECK(blended == expected[i]);
+    }
+    strip.gm.BlendRange(&actual[0], &targets[0], N, amount);
+    CHECK(actual == expected);
+
+    expected = actual = pixels;
+    for(uint16_t i = 0; i < N; i++) { strip.gm.BlendInPlace(expected[i], targets[i], amounts[i]); }
+    strip.gm.BlendRange(&actual[0], &targets[0], N, &amounts[0]);
+    CHECK(actual == expected);
+
+    expected = actual = pixels;
+    for(uint16_t i = 0; i < N; i++) { strip.gm.BlendInPlace(expected[i], targets[0], amount); }
+    strip.gm.BlendRange(&actual[0], targets[0], N, amount);
+    CHECK(actual == expected);
+
+    expected = actual = pixels;
+    for(uint16_t i = 0; i < N; i++) { strip.gm.BlendInPlace(expected[i], targets[0], amounts[i]); }
+    strip.gm.BlendRange(&actual[0], targets[0], N, &amounts[0]);
+    CHECK(actual == expected);
+  }
+}
+
+// Correct(Inverse(x)) lands on the value nearest x that the shipped gamma matrices can output
+static void TestRoundTrip() {
+  TestStrip strip(1);
+  const uint8_t* gammas[3] = { defaultGammaProfile.gammaR, defaultGammaProfile.gammaG, defaultGammaProfile.gammaB };
+  uint8_t maxError[3] = { 0, 0, 0 };
+  for(uint16_t v = 0; v <= 255; v++) {
+    CRGB pixel(v, v, v);
+    strip.gm.Inverse(pixel);
+    strip.gm.Correct(pixel);
+    for(uint8_t c = 0; c < 3; c++) {
+      uint8_t error = abs(pixel.raw[c] - v);
+      if(error > maxError[c]) { maxError[c] = error; }
+      for(uint16_t k = 0; k <= 255; k++) { CHECK(abs(pgm_read_byte(&gammas[c][k]) - int(v)) >= error); }
+    }
+  }
+  printf("Round trip max error: R:%u G:%u B:%u\n", maxError[0], maxError[1], maxError[2]);
+}
+
+// Crossfades give the endpoint frames exactly, match BlendInPlace() when brightness doesn't change, keep the target color when
+// fading in from dark, move leds_b steadily toward the target, and reuse runs without changing the result
+static void TestCrossfade() {
+  const uint16_t N = 300;
+  TestStrip strip(N);
+  TestStrip single(1);
+  std::vector<CRGB> from(N), to(N), out(N);
+  std::vector<uint8_t> from_b(N), to_b(N), out_b(N);
+  for(uint16_t frameNum = 0; frameNum < 64; frameNum++) {
+    RandomScene(&from[0], &from_b[0], 0, N);
+    RandomScene(&to[0], &to_b[0], 0, N);
+    strip.gm.CrossfadeFrames(&from[0], &from_b[0], &to[0], &to_b[0], 0, &out[0], &out_b[0]);
+    CHECK(out == from && out_b == from_b);
+    strip.gm.CrossfadeFrames(&from[0], &from_b[0], &to[0], &to_b[0], 255, &out[0], &out_b[0]);
+    CHECK(out == to && out_b == to_b);
+
+    uint8_t amount = 1 + random8(254);
+    strip.gm.CrossfadeFrames(&from[0], &from_b[0], &to[0], &to_b[0], amount, &out[0], &out_b[0]);
+    for(uint16_t i = 0; i < N; i++) {
+      // Each pixel alone, so no run is reused
+      CRGB alone;
+      uint8_t alone_b;
+      single.gm.CrossfadeFrames(&from[i], &from_b[i], &to[i], &to_b[i], amount, &alone, &alone_b);
+      CHECK(out[i] == alone && out_b[i] == alone_b);
+
+      // Equal endpoints are copied rather than round tripped, so BlendInPlace() only applies to differing colors
+      if(from_b[i] == to_b[i] && from[i] != to[i]) {
+        CRGB blended = from[i];
+        CRGB target = to[i];
+        strip.gm.BlendInPlace(blended, target, amount);
+        CHECK(out[i] == blended && out_b[i] == from_b[i]);
+      }
+      if(from_b[i] == 0 && to_b[i] > 0) { CHECK(out[i] == to[i]); }
+    }
+  }
+
+  // leds_b moves monotonically from one level to the other as amount rises
+  for(uint16_t round = 0; round < 256; round++) {
+    CRGB a(random8(), random8(), random8()), b(random8(), random8(), random8());
+    uint8_t aB = random8(), bB = random8();
+    uint8_t last = aB;
+    for(uint16_t amount = 0; amount < 256; amount++) {
+      CRGB mixed;
+      uint8_t mixedB;
+      single.gm.CrossfadeFrames(&a, &aB, &b, &bB, amount, &mixed, &mixedB);
+      CHECK(bB >= aB ? (mixedB >= last && mixedB <= bB) : (mixedB <= last && mixedB >= bB));
+      last = mixedB;
+    }
+    CHECK(last == bB);
+  }
+
+  // Without out_b, leds_b is written even when outLeds is given
+  RandomScene(&from[0], &from_b[0], 0, N);
+  strip.gm.CrossfadeFrames(&from[0], &from_b[0], &to[0], &to_b[0], 0, &out[0]);
+  CHECK(out == from && strip.leds_b == from_b);
+  strip.gm.CrossfadeFrames(&from[0], &from_b[0], &to[0], &to_b[0], 255);
+  CHECK(strip.leds == to && strip.leds_b == to_b);
+}
+
+// Gradients are linear interpolation rounded to nearest (up to fixed point ties) and passed through Inverse(). Before that step they are within 1 of
+// FastLED's fill_gradient_RGB() on short gradients, where its truncated step has not drifted yet. Multi-stop fills hit each stop
+// exactly, and empty fills write nothing
+static void TestGradients() {
+  TestStrip strip(1);
+  const uint8_t* reverseGammas[3] = { defaultGammaProfile.reverseGammaR, defaultGammaProfile.reverseGammaG, defaultGammaProfile.reverseGammaB };
+  const uint16_t lengths[] = { 1, 2, 3, 17, 300, 4000 };
+  for(uint16_t count : lengths) {
+    std::vector<CRGB> pixels(count), fastled(count);
+    for(uint8_t round = 0; round < 16; round++) {
+      CRGB start(random8(), random8(), random8());
+      CRGB end(random8(), random8(), random8());
+      strip.gm.FillGradientRGB(&pixels[0], count, start, end);
+      fill_gradient_RGB(&fastled[0], 0, start, count - 1, end);
+      uint16_t steps = count > 1 ? count - 1 : 1;
+      for(uint16_t i = 0; i < count; i++) {
+        for(uint8_t c = 0; c < 3; c++) {
+          double exact = start.raw[c] + (end.raw[c] - start.raw[c]) * double(i) / steps;
+          int ideal = int(floor(exact + 0.5));
+          // The 16.16 step carries up to count/65536 of a level of rounding error, which can tip a value sitting on .5
+          bool tie = fabs(exact - floor(exact) - 0.5) < double(count) / 65536;
+          int other = ideal > exact ? ideal - 1 : ideal + 1;
+          CHECK(pixels[i].raw[c] == pgm_read_byte(&reverseGammas[c][ideal]) ||
+                (tie && pixels[i].raw[c] == pgm_read_byte(&reverseGammas[c][other])));
+          if(count <= 17) { CHECK(abs(ideal - fastled[i].raw[c]) <= 1); }
+        }
+      }
+
+      CHSV startHSV(random8(), random8(), random8());
+      CHSV endHSV(random8(), random8(), random8());
+      CRGB first = startHSV, last = endHSV;
+      strip.gm.Inverse(first);
+      strip.gm.Inverse(last);
+      strip.gm.FillGradientHSV(&pixels[0], count, startHSV, endHSV);
+      CHECK(pixels[0] == first);
+      if(count > 1) { CHECK(pixels[count - 1] == last); }
+    }
+  }
+
+  CRGB stops[4] = { CRGB(255, 0, 0), CRGB(0, 255, 0), CRGB(0, 0, 255), CRGB(255, 255, 255) };
+  CHSV hsvStops[4] = { CHSV(0, 255, 255), CHSV(96, 255, 128), CHSV(160, 128, 255), CHSV(32, 0, 64) };
+  for(uint16_t count : lengths) {
+    std::vector<CRGB> pixels(count);
+    strip.gm.FillGradientRGB(&pixels[0], count, stops, 4);
+    for(uint8_t s = 0; s < 4; s++) {
+      CRGB expected = stops[s];
+      strip.gm.Inverse(expected);
+      // With fewer pixels than stops, later stops overwrite earlier ones, except that a single pixel takes the first stop
+      if(count > 3 || (count > 1 ? s == 3 : s == 0)) { CHECK(pixels[uint32_t(count - 1) * s / 3] == expected); }
+    }
+    strip.gm.FillGradientHSV(&pixels[0], count, hsvStops, 4);
+    CRGB lastStop = hsvStops[count > 1 ? 3 : 0];
+    strip.gm.Inverse(lastStop);
+    CHECK(pixels[count - 1] == lastStop);
+  }
+
+  CRGB canary(1, 2, 3);
+  strip.gm.FillGradientRGB(&canary, 0, stops, 4);
+  strip.gm.FillGradientHSV(&canary, 0, hsvStops, 4);
+  strip.gm.FillGradientRGB(&canary, 0, stops[0], stops[1]);
+  strip.gm.FillGradientHSV(&canary, 0, hsvStops[0], hsvStops[1]);
+  CHECK(canary == CRGB(1, 2, 3));
+}
+
+// A Stream fed from a byte queue, collecting whatever is written to it
+struct PacketStream : public Stream {
+  std::vector<uint8_t> input;
+  size_t inputPos = 0;
+  std::vector<uint8_t> output;
+
+  int available() { return input.size() - inputPos; }
+  int read() { return inputPos < input.size() ? input[inputPos++] : -1; }
+  int peek() { return inputPos < input.size() ? input[inputPos] : -1; }
+  size_t write(uint8_t c) {
+    output.push_back(c);
+    return 1;
+  }
+
+  // Queues a binary protocol packet; a nonzero corrupt is added to its checksum
+  void Send(uint8_t command, const std::vector<uint8_t>& payload, uint8_t corrupt = 0) {
+    uint8_t header[4] = { GAMMA_BINARY_SYNC, command, uint8_t(payload.size() & 0xFF), uint8_t(payload.size() >> 8) };
+    uint8_t sum = header[1] + header[2] + header[3];
+    for(uint8_t c : payload) { sum += c; }
+    input.insert(input.end(), header, header + 4);
+    input.insert(input.end(), payload.begin(), payload.end());
+    input.push_back(uint8_t(-sum) + corrupt);
+  }
+
+  // Status byte of the single reply written since the last call
+  int ReplyStatus(uint8_t command) {
+    std::vector<uint8_t> reply = output;
+    output.clear();
+    if(reply.size() != 6 || reply[0] != GAMMA_BINARY_SYNC || reply[1] != (command | 0x80) || reply[2] != 1 || reply[3] != 0) { return -1; }
+    if(uint8_t(reply[1] + reply[2] + reply[3] + reply[4] + reply[5]) != 0) { return -1; }
+    return reply[4];
+  }
+};
+
+// FRAME, TABLE and BRIGHTNESS packets, including the ones that must be refused without touching anything
+static void TestBinaryProtocol() {
+  const uint16_t N = 16;
+  TestStrip strip(N);
+  PacketStream stream;
+  std::vector<uint8_t> tables(8*256);
+  strip.gm.SetTableUploadBuffer(&tables[0]);
+
+  // Two pixels at index 3
+  std::vector<uint8_t> frame = { 3, 0, 10, 20, 30, 40, 50, 60, 70, 80 };
+  stream.Send(GAMMA_CMD_FRAME, frame);
+  strip.gm.ProcessBinaryInput(stream);
+  CHECK(stream.ReplyStatus(GAMMA_CMD_FRAME) == GAMMA_STATUS_OK);
+  CHECK(strip.leds[3] == CRGB(10, 20, 30) && strip.leds_b[3] == 40);
+  CHECK(strip.leds[4] == CRGB(50, 60, 70) && strip.leds_b[4] == 80);
+
+  std::vector<GammaPixel> packed(N);
+  strip.gm.SetPackedBuffer(&packed[0]);
+  stream.Send(GAMMA_CMD_FRAME, frame);
+  strip.gm.ProcessBinaryInput(stream);
+  CHECK(stream.ReplyStatus(GAMMA_CMD_FRAME) == GAMMA_STATUS_OK);
+  CHECK(packed[4].r == 50 && packed[4].g == 60 && packed[4].b == 70 && packed[4].brightness == 80);
+
+  // Linear and indexed buffers don't hold 8-bit colors, so frames are refused and leds[] (their output) is left alone
+  std::vector<CRGB16> linear(N);
+  std::vector<uint8_t> indices(N);
+  std::vector<GammaPixel> palette(4), preparedPalette(4);
+  std::vector<uint8_t> other = { 3, 0, 1, 2, 3, 4, 5, 6, 7, 8 };
+  strip.gm.SetLinearBuffer(&linear[0]);
+  stream.Send(GAMMA_CMD_FRAME, other);
+  strip.gm.ProcessBinaryInput(stream);
+  CHECK(stream.ReplyStatus(GAMMA_CMD_FRAME) == GAMMA_STATUS_BAD_PACKET);
+  strip.gm.SetIndexedBuffer(&indices[0], &palette[0], &preparedPalette[0], 4);
+  stream.Send(GAMMA_CMD_FRAME, other);
+  strip.gm.ProcessBinaryInput(stream);
+  CHECK(stream.ReplyStatus(GAMMA_CMD_FRAME) == GAMMA_STATUS_BAD_PACKET);
+  CHECK(strip.leds[3] == CRGB(10, 20, 30) && strip.leds_b[3] == 40);
+  strip.gm.SetIndexedBuffer(NULL, NULL, NULL, 0);
+
+  // Upload gammaG inverted, then check Correct() uses it
+  std::vector<uint8_t> table(257);
+  table[0] = 1;
+  for(uint16_t i = 0; i < 256; i++) { table[i + 1] = 255 - i; }
+  stream.Send(GAMMA_CMD_TABLE, table);
+  strip.gm.ProcessBinaryInput(stream);
+  CHECK(stream.ReplyStatus(GAMMA_CMD_TABLE) == GAMMA_STATUS_OK);
+  CRGB pixel(0, 0, 0);
+  strip.gm.Correct(pixel);
+  CHECK(pixel.g == 255);
+
+  // BRIGHTNESS payloads never reach the uploaded tables, even when the packet is refused; this one starts like a gammaG upload
+  std::vector<uint8_t> tablesBefore = tables;
+  stream.Send(GAMMA_CMD_BRIGHTNESS, { 1, 238, 238, 238, 238, 238, 238 });
+  strip.gm.ProcessBinaryInput(stream);
+  CHECK(stream.ReplyStatus(GAMMA_CMD_BRIGHTNESS) == GAMMA_STATUS_BAD_PACKET);
+  CHECK(tables == tablesBefore);
+  CHECK(strip.brightness == 128);
+
+  stream.Send(GAMMA_CMD_BRIGHTNESS, std::vector<uint8_t>(1, 77));
+  strip.gm.ProcessBinaryInput(stream);
+  CHECK(stream.ReplyStatus(GAMMA_CMD_BRIGHTNESS) == GAMMA_STATUS_OK);
+  CHECK(strip.brightness == 77);
+  CHECK(tables == tablesBefore);
+
+  stream.Send(GAMMA_CMD_BRIGHTNESS, std::vector<uint8_t>(1, 99), 1);
+  strip.gm.ProcessBinaryInput(stream);
+  CHECK(stream.ReplyStatus(GAMMA_CMD_BRIGHTNESS) == GAMMA_STATUS_BAD_CHECKSUM);
+  CHECK(strip.brightness == 77);
+
+  // Back-to-back packets are all handled, and text after them is left for the serial parser
+  stream.Send(GAMMA_CMD_BRIGHTNESS, std::vector<uint8_t>(1, 50));
+  stream.Send(GAMMA_CMD_BRIGHTNESS, std::vector<uint8_t>(1, 60));
+  stream.input.push_back('n');
+  stream.input.push_back('\n');
+  strip.gm.ProcessBinaryInput(stream);
+  CHECK(strip.brightness == 60);
+  CHECK(stream.available() == 2 && stream.read() == 'n');
+}
+
+#ifdef ENABLE_COLOR_CORRECTION_TESTS
+// The calibration loop's serial parser, fed through the stub Serial: lines end at a newline or after idle input, prompting
+// commands take the next line as their value, and binary packets can arrive between lines
+static void TestSerial() {
+  const uint16_t N = 300;
+  TestStrip strip(N);
+  std::string output;
+  HostSerialCapture(&output);
+  SetHostMillis(1000);
+  strip.gm.BeginTests();
+  uint8_t initial = strip.brightness;
+
+  HostSerialInput("=\n");
+  strip.gm.Tick();
+  CHECK(strip.brightness == initial + 1);
+
+  // A line without a newline waits for 100ms of idle input; one split across polls is still one line
+  HostSerialInput("20");
+  strip.gm.Tick();
+  SetHostMillis(1050);
+  HostSerialInput("0");
+  strip.gm.Tick();
+  SetHostMillis(1149);
+  strip.gm.Tick();
+  CHECK(strip.brightness == initial + 1);
+  SetHostMillis(1150);
+  strip.gm.Tick();
+  CHECK(strip.brightness == 200);
+
+  // 'n' moves to the next of the 9 patterns, so nine of them in one poll come back to the first
+  std::vector<CRGB> firstPattern = strip.leds;
+  HostSerialInput("n\n");
+  strip.gm.Tick();
+  CHECK(strip.leds != firstPattern);
+  HostSerialInput("n\nn\nn\nn\nn\nn\nn\nn\n");
+  strip.gm.Tick();
+  CHECK(strip.leds == firstPattern);
+
+  // Prompting commands take the next line as their value, whether it comes in the same poll or a later one
+  output.clear();
+  HostSerialInput("r\n");
+  strip.gm.Tick();
+  CHECK(output.find("Enter new red gamma value") != std::string::npos);
+  HostSerialInput("2.5\n");
+  strip.gm.Tick();
+  CHECK(output.find("Gammas: R:2.50") != std::string::npos);
+  HostSerialInput("c\nff8040\n");
+  strip.gm.Tick();
+  CHECK(output.find("Color Correction: 0xFF8040") != std::string::npos);
+  CHECK(strip.brightness == 200);
+
+  // A packet between lines, split across polls, with text in the same polls on both sides. It sets the brightness the line
+  // before it left, so only the pattern switch after it changes the frame
+  PacketStream packet;
+  packet.Send(GAMMA_CMD_BRIGHTNESS, std::vector<uint8_t>(1, 201));
+  std::vector<uint8_t> reply = { GAMMA_BINARY_SYNC, GAMMA_CMD_BRIGHTNESS | 0x80, 1, 0, GAMMA_STATUS_OK };
+  reply.push_back(uint8_t(-(reply[1] + reply[2] + reply[3] + reply[4])));
+  output.clear();
+  HostSerialInput("=\n");
+  HostSerialInput(&packet.input[0], 3);
+  strip.gm.Tick();
+  CHECK(strip.brightness == 201);
+  std::vector<CRGB> before = strip.leds;
+  HostSerialInput(&packet.input[3], packet.input.size() - 3);
+  HostSerialInput("n\n");
+  strip.gm.Tick();
+  CHECK(strip.brightness == 201);
+  CHECK(output.find(std::string(reply.begin(), reply.end())) != std::string::npos);
+  CHECK(strip.leds != before);
+  CHECK(Serial.available() == 0);
+  HostSerialCapture(NULL);
+}
+#endif
+
+#ifdef ENABLE_GAMMA_STATS
+// Every Prep entry point records one call, and counts each pixel once as lit or black
+static void TestStats() {
+  const uint16_t N = 300;
+  TestStrip strip(N);
+  std::vector<uint8_t> frame(strip.gm.APA102FrameSize());
+  std::vector<uint8_t> buffer0(4*32), buffer1(4*32);
+  ChunkCollector collector;
+  RandomScene(strip);
+  strip.Reference();
+  uint32_t lit = 0;
+  for(uint16_t i = 0; i < N; i++) { lit += strip.ref5bit[i] != 0; }
+
+  strip.gm.ResetStats();
+  strip.Draw();
+  strip.gm.PrepPixelsForFastLED();
+  CHECK(strip.gm.GetStats().prepCount == 1);
+  CHECK(strip.gm.GetStats().litPixels == lit);
+  CHECK(strip.gm.GetStats().blackPixels == N - lit);
+
+  strip.Draw();
+  strip.gm.PrepAPA102Frame(&frame[0]);
+  CHECK(strip.gm.GetStats().prepCount == 2);
+  CHECK(strip.gm.GetStats().litPixels == 2*lit);
+
+  strip.gm.PrepAPA102Pipelined(&buffer0[0], &buffer1[0], 32, ChunkCollector::Sink, &collector);
+  CHECK(strip.gm.GetStats().prepCount == 3);
+  CHECK(strip.gm.GetStats().litPixels == 3*lit);
+  CHECK(strip.gm.GetStats().blackPixels == 3*(N - lit));
+
+  // A dark frame counts every pixel as black, on each path
+  strip.brightness = 0;
+  strip.gm.PrepPixelsForFastLED();
+  strip.gm.PrepAPA102Frame(&frame[0]);
+  strip.gm.PrepAPA102Pipelined(&buffer0[0], &buffer1[0], 32, ChunkCollector::Sink, &collector);
+  CHECK(strip.gm.GetStats().prepCount == 6);
+  CHECK(strip.gm.GetStats().litPixels == 3*lit);
+  CHECK(strip.gm.GetStats().blackPixels == 3*(N - lit) + 3*N);
+
+  uint32_t histogramTotal = 0;
+  for(uint8_t i = 0; i < 32; i++) { histogramTotal += strip.gm.GetStats().ticksHistogram[i]; }
+  CHECK(histogramTotal == 6);
+}
+#endif
+
+#ifdef GAMMA_PARALLEL_PREP
+// Prep split with the worker task matches the reference, for full and partial passes and with the power estimate.
+// The worker task never exits, so the strip is never freed
+static void TestParallel() {
+  const uint16_t N = 1000;
+  TestStrip& strip = *new TestStrip(N);
+  const uint8_t model[4] = { 16, 11, 15, 1 };
+  strip.gm.EnableParallelPrep(true);
+  for(uint16_t frameNum = 0; frameNum < 512; frameNum++) {
+    strip.brightness = random8();
+    RandomScene(strip);
+    strip.Draw();
+    strip.gm.PrepPixelsForFastLED();
+    strip.Reference();
+    CHECK_PIXELS("Parallel Prep", &strip.ref[0], &strip.ref5bit[0], &strip.leds[0], &strip.leds_5bit[0], N, true);
+  }
+
+  strip.gm.EnablePowerEstimate(true);
+  for(uint16_t frameNum = 0; frameNum < 64; frameNum++) {
+    RandomScene(strip);
+    strip.Draw();
+    strip.gm.PrepPixelsForFastLED();
+    strip.Reference();
+    CHECK_PIXELS("Parallel Prep, measuring power", &strip.ref[0], &strip.ref5bit[0], &strip.leds[0], &strip.leds_5bit[0], N, true);
+    CHECK(strip.gm.GetEstimatedMilliamps() == ReferenceMilliamps(strip, model));
+  }
+  strip.gm.EnablePowerEstimate(false);
+
+  strip.gm.EnableDirtyTracking(true);
+  strip.Draw();
+  strip.gm.PrepPixelsForFastLED();
+  for(uint16_t frameNum = 0; frameNum < 256; frameNum++) {
+    uint16_t first = random16() % (N / 2);
+    uint16_t last = first + 256 + random16() % (N / 2 - 255);
+    RandomScene(&strip.scene[0], &strip.scene_b[0], first, last);
+    strip.Draw(first, last);
+    strip.gm.MarkDirty(first, last - first);
+    strip.gm.PrepPixelsForFastLED();
+    strip.Reference();
+    CHECK_PIXELS("Parallel dirty Prep", &strip.ref[0], &strip.ref5bit[0], &strip.leds[0], &strip.leds_5bit[0], N, true);
+  }
+}
+#endif
+
+struct TestCase {
+  const char* name;
+  void (*run)();
+};
+
+static const TestCase tests[] = {
+  { "prep_exhaustive", TestPrepExhaustive },
+  { "prep_random", TestPrepRandom },
+  { "prep_dirty_in_place", TestPrepDirtyInPlace },
+  { "prep_dirty_packed", TestPrepDirtyPacked },
+  { "prep_dirty_output_buffer", TestPrepDirtyOutputBuffer },
+  { "prep_double_buffer", TestPrepDoubleBuffer },
+  { "ramp", TestRamp },
+  { "power", TestPower },
+  { "apa102_pipelined", TestAPA102Pipelined },
+  { "range_kernels", TestRangeKernels },
+  { "round_trip", TestRoundTrip },
+  { "crossfade", TestCrossfade },
+  { "gradients", TestGradients },
+  { "binary_protocol", TestBinaryProtocol },
+  #ifdef ENABLE_COLOR_CORRECTION_TESTS
+    { "serial", TestSerial },
+  #endif
+  #ifdef ENABLE_GAMMA_STATS
+    { "stats", TestStats },
+  #endif
+  #ifdef GAMMA_PARALLEL_PREP
+    { "parallel", TestParallel },
+  #endif
+};
+
+int main(int argc, char** argv) {
+  for(int i = 1; i < argc; i++) {
+    bool known = false;
+    for(const TestCase& test : tests) { known = known || strcmp(argv[i], test.name) == 0; }
+    if(!known) {
+      fprintf(stderr, "Unknown test %s\n", argv[i]);
+      return 2;
+    }
+  }
+
+  for(const TestCase& test : tests) {
+    bool run = argc == 1;
+    for(int i = 1; i < argc; i++) { run = run || strcmp(argv[i], test.name) == 0; }
+    if(!run) { continue; }
+    uint32_t before = failures;
+    test.run();
+    printf("%-26s %s\n", test.name, failures == before ? "passed" : "FAILED");
+  }
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,115 @@
+#pragma once
+// Minimal stand-in for the Arduino core, enough to build GammaManager on a desktop compiler.
+// Serial writes to stdout and reads what HostSerialInput() queued; PROGMEM is ordinary memory.
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <string>
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+
+#define DEC 10
+#define HEX 16
+
+using std::min;
+using std::max;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+
+// Freezes millis() at ms, for tests of time-based behavior; the clock is real until first called
+void SetHostMillis(unsigned long ms);
+
+class String {
+  public:
+    String() {}
+    String(const char* s) : str(s) {}
+    String(const std::string& s) : str(s) {}
+    String(char c) : str(1, c) {}
+    String(int value, uint8_t base = DEC) { FromInteger(value < 0, value < 0 ? -(long)value : value, base); }
+    String(unsigned int value, uint8_t base = DEC) { FromInteger(false, value, base); }
+    String(long value, uint8_t base = DEC) { FromInteger(value < 0, value < 0 ? -value : value, base); }
+    String(unsigned long value, uint8_t base = DEC) { FromInteger(false, value, base); }
+    String(float value, uint8_t decimals = 2) { FromFloat(value, decimals); }
+    String(double value, uint8_t decimals = 2) { FromFloat(value, decimals); }
+
+    unsigned int length() const { return str.size(); }
+    const char* c_str() const { return str.c_str(); }
+    char operator[](unsigned int i) const { return i < str.size() ? str[i] : 0; }
+    char& operator[](unsigned int i) { return str[i]; }
+    bool operator==(const String& other) const { return str == other.str; }
+    bool operator==(const char* other) const { return str == other; }
+    bool operator!=(const String& other) const { return str != other.str; }
+    bool operator!=(const char* other) const { return str != other; }
+    String& operator+=(const String& other) { str += other.str; return *this; }
+    String& operator+=(const char* other) { str += other; return *this; }
+    String& operator+=(char c) { str += c; return *this; }
+    friend String operator+(const String& a, const String& b) { return String(a.str + b.str); }
+    friend String operator+(const String& a, const char* b) { return String(a.str + b); }
+    friend String operator+(const char* a, const String& b) { return String(a + b.str); }
+
+    void trim();
+    void toUpperCase();
+    long toInt() const { return atol(str.c_str()); }
+    float toFloat() const { return atof(str.c_str()); }
+
+  private:
+    std::string str;
+    void FromInteger(bool negative, unsigned long value, uint8_t base);
+    void FromFloat(double value, uint8_t decimals);
+};
+
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size);
+    size_t print(const String& s) { return write((const uint8_t*)s.c_str(), s.length()); }
+    size_t print(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+    size_t print(char c) { return write(c); }
+    size_t print(int value, uint8_t base = DEC) { return print(String(value, base)); }
+    size_t print(unsigned int value, uint8_t base = DEC) { return print(String(value, base)); }
+    size_t print(long value, uint8_t base = DEC) { return print(String(value, base)); }
+    size_t print(unsigned long value, uint8_t base = DEC) { return print(String(value, base)); }
+    size_t print(double value, uint8_t decimals = 2) { return print(String(value, decimals)); }
+    size_t println() { return write('\n'); }
+    template<typename T> size_t println(const T& value) { return print(value) + println(); }
+};
+
+class Stream : public Print {
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+};
+
+class HardwareSerial : public Stream {
+  public:
+    void begin(unsigned long) {}
+    int available();
+    int read();
+    int peek();
+    size_t write(uint8_t c);
+    size_t write(const uint8_t* buffer, size_t size);
+};
+
+extern HardwareSerial Serial;
+
+// Queues bytes for Serial to read, for tests of serial input
+void HostSerialInput(const uint8_t* data, size_t size);
+void HostSerialInput(const char* text);
+// Appends Serial's output to capture instead of writing it to stdout; NULL restores stdout
+void HostSerialCapture(std::string* capture);
+
+// Cycle counter for ENABLE_GAMMA_STATS on ESP builds; counts nanoseconds on the host
+class EspClass {
+  public:
+    uint32_t getCycleCount();
+};
+extern EspClass ESP;
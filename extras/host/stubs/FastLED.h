@@ -0,0 +1,90 @@
+#pragma once
+// Minimal stand-in for FastLED: the color types and the math GammaManager uses, with FastLED's fixed-point
+// rounding (FASTLED_SCALE8_FIXED, FASTLED_BLEND_FIXED). hsv2rgb_rainbow() is a simple hue wheel rather than
+// FastLED's rainbow conversion, and show() does nothing.
+#include "Arduino.h"
+
+typedef uint8_t fract8;
+typedef uint16_t fract16;
+
+inline uint8_t scale8(uint8_t i, fract8 scale) {
+  return (uint16_t(i) * (1 + uint16_t(scale))) >> 8;
+}
+
+inline uint8_t scale8_video(uint8_t i, fract8 scale) {
+  return ((uint16_t(i) * scale) >> 8) + ((i && scale) ? 1 : 0);
+}
+
+inline uint8_t blend8(uint8_t a, uint8_t b, fract8 amountOfB) {
+  uint16_t partial = (a << 8) | b;
+  partial -= a * amountOfB;
+  partial += b * amountOfB;
+  return partial >> 8;
+}
+
+inline uint8_t random8() { return rand() & 0xFF; }
+inline uint8_t random8(uint8_t lim) { return (uint16_t(random8()) * lim) >> 8; }
+inline uint16_t random16() { return rand() & 0xFFFF; }
+
+struct CHSV {
+  union {
+    struct {
+      union { uint8_t hue; uint8_t h; };
+      union { uint8_t sat; uint8_t s; };
+      union { uint8_t val; uint8_t v; };
+    };
+    uint8_t raw[3];
+  };
+  CHSV() {}
+  CHSV(uint8_t ih, uint8_t is, uint8_t iv) : hue(ih), sat(is), val(iv) {}
+};
+
+struct CRGB;
+void hsv2rgb_rainbow(const CHSV& hsv, CRGB& rgb);
+
+struct CRGB {
+  union {
+    struct {
+      union { uint8_t r; uint8_t red; };
+      union { uint8_t g; uint8_t green; };
+      union { uint8_t b; uint8_t blue; };
+    };
+    uint8_t raw[3];
+  };
+
+  CRGB() {}
+  CRGB(uint8_t ir, uint8_t ig, uint8_t ib) : r(ir), g(ig), b(ib) {}
+  CRGB(uint32_t colorcode) : r(colorcode >> 16), g(colorcode >> 8), b(colorcode) {}
+  CRGB(const CHSV& hsv) { hsv2rgb_rainbow(hsv, *this); }
+  CRGB& operator=(uint32_t colorcode) { r = colorcode >> 16; g = colorcode >> 8; b = colorcode; return *this; }
+
+  uint8_t& operator[](uint8_t x) { return raw[x]; }
+  const uint8_t& operator[](uint8_t x) const { return raw[x]; }
+
+  CRGB& nscale8(uint8_t scale) { r = scale8(r, scale); g = scale8(g, scale); b = scale8(b, scale); return *this; }
+  CRGB& nscale8(const CRGB& scale) { r = scale8(r, scale.r); g = scale8(g, scale.g); b = scale8(b, scale.b); return *this; }
+  CRGB& nscale8_video(uint8_t scale) { r = scale8_video(r, scale); g = scale8_video(g, scale); b = scale8_video(b, scale); return *this; }
+
+  enum HTMLColorCode { Black = 0x000000, White = 0xFFFFFF, Red = 0xFF0000, Green = 0x008000, Blue = 0x0000FF };
+};
+
+inline bool operator==(const CRGB& a, const CRGB& b) { return a.r == b.r && a.g == b.g && a.b == b.b; }
+inline bool operator!=(const CRGB& a, const CRGB& b) { return !(a == b); }
+
+CRGB blend(const CRGB& p1, const CRGB& p2, fract8 amountOfP2);
+CRGB& nblend(CRGB& existing, const CRGB& overlay, fract8 amountOfOverlay);
+
+enum TGradientDirectionCode { FORWARD_HUES, BACKWARD_HUES, SHORTEST_HUES, LONGEST_HUES };
+void fill_gradient(CRGB* leds, uint16_t numLeds, const CHSV& c1, const CHSV& c2, TGradientDirectionCode directionCode = SHORTEST_HUES);
+void fill_gradient_RGB(CRGB* leds, uint16_t startpos, CRGB startcolor, uint16_t endpos, CRGB endcolor);
+
+enum EOrder { RGB = 0012, RBG = 0021, GRB = 0102, GBR = 0120, BRG = 0201, BGR = 0210 };
+#define RGB_BYTE0(X) ((X>>6) & 0x3)
+#define RGB_BYTE1(X) ((X>>3) & 0x3)
+#define RGB_BYTE2(X) ((X) & 0x3)
+
+class CFastLED {
+  public:
+    void show() {}
+};
+extern CFastLED FastLED;
@@ -0,0 +1,120 @@
+#include "Arduino.h"
+#include <stdio.h>
+#include <chrono>
+#include <deque>
+#include <thread>
+
+HardwareSerial Serial;
+static std::deque<uint8_t> serialInput;
+static std::string* serialCapture = NULL;
+
+static const std::chrono::steady_clock::time_point hostStart = std::chrono::steady_clock::now();
+static bool hostMillisFrozen = false;
+static unsigned long hostMillis = 0;
+
+unsigned long millis() {
+  if(hostMillisFrozen) { return hostMillis; }
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - hostStart).count();
+}
+
+unsigned long micros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - hostStart).count();
+}
+
+void delay(unsigned long ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void yield() {
+  std::this_thread::yield();
+}
+
+void SetHostMillis(unsigned long ms) {
+  hostMillisFrozen = true;
+  hostMillis = ms;
+}
+
+EspClass ESP;
+
+uint32_t EspClass::getCycleCount() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - hostStart).count();
+}
+
+void String::trim() {
+  size_t first = str.find_first_not_of(" \t\r\n");
+  if(first == std::string::npos) {
+    str.clear();
+    return;
+  }
+  size_t last = str.find_last_not_of(" \t\r\n");
+  str = str.substr(first, last - first + 1);
+}
+
+void String::toUpperCase() {
+  for(size_t i = 0; i < str.size(); i++) {
+    if(str[i] >= 'a' && str[i] <= 'z') { str[i] -= 'a' - 'A'; }
+  }
+}
+
+void String::FromInteger(bool negative, unsigned long value, uint8_t base) {
+  char digits[sizeof(unsigned long) * 8 + 2];
+  char* p = &digits[sizeof(digits) - 1];
+  *p = 0;
+  do {
+    uint8_t digit = value % base;
+    *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+    value /= base;
+  } while(value > 0);
+  if(negative) { *--p = '-'; }
+  str = p;
+}
+
+void String::FromFloat(double value, uint8_t decimals) {
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "%.*f", decimals, value);
+  str = buffer;
+}
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+  for(size_t i = 0; i < size; i++) { write(buffer[i]); }
+  return size;
+}
+
+int HardwareSerial::available() {
+  return serialInput.size();
+}
+
+int HardwareSerial::read() {
+  if(serialInput.empty()) { return -1; }
+  uint8_t c = serialInput.front();
+  serialInput.pop_front();
+  return c;
+}
+
+int HardwareSerial::peek() {
+  return serialInput.empty() ? -1 : serialInput.front();
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+  if(serialCapture != NULL) {
+    serialCapture->append((const char*)buffer, size);
+    return size;
+  }
+  return fwrite(buffer, 1, size, stdout);
+}
+
+void HostSerialInput(const uint8_t* data, size_t size) {
+  serialInput.insert(serialInput.end(), data, data + size);
+}
+
+void HostSerialInput(const char* text) {
+  HostSerialInput((const uint8_t*)text, strlen(text));
+}
+
+void HostSerialCapture(std::string* capture) {
+  serialCapture = capture;
+}
@@ -0,0 +1,100 @@
+#include "FastLED.h"
+
+CFastLED FastLED;
+
+CRGB blend(const CRGB& p1, const CRGB& p2, fract8 amountOfP2) {
+  return CRGB(blend8(p1.r, p2.r, amountOfP2), blend8(p1.g, p2.g, amountOfP2), blend8(p1.b, p2.b, amountOfP2));
+}
+
+CRGB& nblend(CRGB& existing, const CRGB& overlay, fract8 amountOfOverlay) {
+  existing = blend(existing, overlay, amountOfOverlay);
+  return existing;
+}
+
+// Six-sector hue wheel; close enough to FastLED's rainbow for test patterns and benchmarks
+void hsv2rgb_rainbow(const CHSV& hsv, CRGB& rgb) {
+  uint8_t sector = hsv.hue / 43;
+  uint8_t offset = (hsv.hue - sector * 43) * 6;
+  uint8_t rising = offset;
+  uint8_t falling = 255 - offset;
+  switch(sector) {
+    case 0: rgb = CRGB(255, rising, 0); break;
+    case 1: rgb = CRGB(falling, 255, 0); break;
+    case 2: rgb = CRGB(0, 255, rising); break;
+    case 3: rgb = CRGB(0, falling, 255); break;
+    case 4: rgb = CRGB(rising, 0, 255); break;
+    default: rgb = CRGB(255, 0, falling); break;
+  }
+
+  // Desaturate toward white, then scale by value
+  uint8_t white = 255 - hsv.sat;
+  for(uint8_t c = 0; c < 3; c++) {
+    rgb.raw[c] = scale8(rgb.raw[c], hsv.sat) + white;
+    rgb.raw[c] = scale8_video(rgb.raw[c], hsv.val);
+  }
+}
+
+// FastLED's 8.7 fixed point gradients, so the stand-in rounds the same way as the real library
+void fill_gradient_RGB(CRGB* leds, uint16_t startpos, CRGB startcolor, uint16_t endpos, CRGB endcolor) {
+  if(endpos < startpos) {
+    uint16_t t = endpos;
+    CRGB tc = endcolor;
+    endcolor = startcolor;
+    endpos = startpos;
+    startpos = t;
+    startcolor = tc;
+  }
+
+  int16_t rdistance87 = (endcolor.r - startcolor.r) << 7;
+  int16_t gdistance87 = (endcolor.g - startcolor.g) << 7;
+  int16_t bdistance87 = (endcolor.b - startcolor.b) << 7;
+  uint16_t pixeldistance = endpos - startpos;
+  int16_t divisor = pixeldistance ? pixeldistance : 1;
+  int16_t rdelta87 = (rdistance87 / divisor) * 2;
+  int16_t gdelta87 = (gdistance87 / divisor) * 2;
+  int16_t bdelta87 = (bdistance87 / divisor) * 2;
+
+  uint16_t r88 = startcolor.r << 8;
+  uint16_t g88 = startcolor.g << 8;
+  uint16_t b88 = startcolor.b << 8;
+  for(uint16_t i = startpos; i <= endpos; i++) {
+    leds[i] = CRGB(r88 >> 8, g88 >> 8, b88 >> 8);
+    r88 += rdelta87;
+    g88 += gdelta87;
+    b88 += bdelta87;
+  }
+}
+
+void fill_gradient(CRGB* leds, uint16_t numLeds, const CHSV& c1, const CHSV& c2, TGradientDirectionCode directionCode) {
+  if(numLeds == 0) { return; }
+  uint16_t endpos = numLeds - 1;
+  int16_t satdistance87 = (c2.sat - c1.sat) << 7;
+  int16_t valdistance87 = (c2.val - c1.val) << 7;
+  uint8_t huedelta8 = c2.hue - c1.hue;
+  if(directionCode == SHORTEST_HUES) { directionCode = huedelta8 > 127 ? BACKWARD_HUES : FORWARD_HUES; }
+  if(directionCode == LONGEST_HUES) { directionCode = huedelta8 < 128 ? BACKWARD_HUES : FORWARD_HUES; }
+
+  int16_t huedistance87;
+  if(directionCode == FORWARD_HUES) {
+    huedistance87 = huedelta8 << 7;
+  }
+  else {
+    huedelta8 = -huedelta8;
+    huedistance87 = -(huedelta8 << 7);
+  }
+
+  int16_t divisor = endpos ? endpos : 1;
+  int16_t huedelta87 = (huedistance87 / divisor) * 2;
+  int16_t satdelta87 = (satdistance87 / divisor) * 2;
+  int16_t valdelta87 = (valdistance87 / divisor) * 2;
+
+  uint16_t hue88 = c1.hue << 8;
+  uint16_t sat88 = c1.sat << 8;
+  uint16_t val88 = c1.val << 8;
+  for(uint16_t i = 0; i <= endpos; i++) {
+    hsv2rgb_rainbow(CHSV(hue88 >> 8, sat88 >> 8, val88 >> 8), leds[i]);
+    hue88 += huedelta87;
+    sat88 += satdelta87;
+    val88 += valdelta87;
+  }
+}
@@ -0,0 +1,56 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+struct HostSemaphore {
+  std::mutex mutex;
+  std::condition_variable ready;
+  bool given = false;
+};
+
+BaseType_t xPortGetCoreID() {
+  return 0;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char*, uint32_t, void* param, UBaseType_t, TaskHandle_t* createdTask, BaseType_t) {
+  std::thread* thread = new std::thread(task, param);
+  thread->detach();
+  if(createdTask != NULL) { *createdTask = thread; }
+  return pdPASS;
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t) {
+  return 1;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+  return new HostSemaphore();
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+  HostSemaphore* s = (HostSemaphore*)semaphore;
+  {
+    std::lock_guard<std::mutex> lock(s->mutex);
+    if(s->given) { return pdFALSE; }
+    s->given = true;
+  }
+  s->ready.notify_one();
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticksToWait) {
+  HostSemaphore* s = (HostSemaphore*)semaphore;
+  std::unique_lock<std::mutex> lock(s->mutex);
+  if(ticksToWait == portMAX_DELAY) {
+    s->ready.wait(lock, [s]() { return s->given; });
+  }
+  else if(!s->ready.wait_for(lock, std::chrono::milliseconds(ticksToWait), [s]() { return s->given; })) {
+    return pdFALSE;
+  }
+  s->given = false;
+  return pdTRUE;
+}
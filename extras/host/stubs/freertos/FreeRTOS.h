@@ -0,0 +1,17 @@
+#pragma once
+// Stand-in for the ESP32 FreeRTOS API GammaManager's parallel Prep uses, on std::thread. Tasks are detached threads
+// (there are no cores to pin to) and binary semaphores are a mutex and condition variable.
+#include <stdint.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef void* TaskHandle_t;
+typedef void* SemaphoreHandle_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS pdTRUE
+#define portMAX_DELAY 0xFFFFFFFF
+
+BaseType_t xPortGetCoreID();